@@ -0,0 +1,39 @@
+#ifndef CHIP8_ALIGNED_NEW_H
+#define CHIP8_ALIGNED_NEW_H
+
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Base for classes with alignas(64) members that are allocated with new. Before C++17 plain new
+// only guarantees the alignment of max_align_t, so T gets an operator new honouring alignof(T).
+template <class T>
+struct AlignedNew {
+    static void* operator new(size_t size) {
+#ifdef _WIN32
+        void* memory = _aligned_malloc(size, alignof(T));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+#else
+        void* memory;
+        if (posix_memalign(&memory, alignof(T), size) != 0) {
+            throw std::bad_alloc();
+        }
+#endif
+        return memory;
+    }
+
+    static void operator delete(void* memory) {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+};
+
+#endif //CHIP8_ALIGNED_NEW_H
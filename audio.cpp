@@ -0,0 +1,184 @@
+#include "audio.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Square wave amplitude, a quarter of full scale
+const int16_t AMPLITUDE = 8192;
+
+void putU16(unsigned char* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+void putU32(unsigned char* out, uint32_t value) {
+    putU16(out, value & 0xFFFF);
+    putU16(out + 2, value >> 16);
+}
+
+}
+
+ToneRing::ToneRing(size_t capacity) : head(0), tail(0), frame(0), dropped(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer.resize(size);
+    mask = size - 1;
+}
+
+bool ToneRing::push(const ToneEvent& event) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == buffer.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    buffer[h & mask] = event;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+void ToneRing::setFrame(uint64_t frames) {
+    frame.store(frames, std::memory_order_release);
+}
+
+size_t ToneRing::pop(ToneEvent* out, size_t max) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t available = head.load(std::memory_order_acquire) - t;
+    size_t count = available < max ? available : max;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = buffer[(t + i) & mask];
+    }
+    tail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+uint64_t ToneRing::getFrame() const {
+    return frame.load(std::memory_order_acquire);
+}
+
+uint64_t ToneRing::getDroppedCount() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+ToneSynth::ToneSynth(ToneRing& ring, unsigned int sampleRate)
+        : ring(ring), sampleRate(sampleRate), pending(ring.getCapacity()) {
+}
+
+void ToneSynth::render(int16_t* out, size_t count) {
+    // Read the tick count first, its events are in the ring by then
+    uint64_t end = samplesAt(ring.getFrame());
+
+    // Top pending up in place, never allocating on the audio thread. Changes that don't fit
+    // stay in the ring until the next call, later than the ones pending anyway.
+    std::copy(pending.begin() + pendingStart, pending.begin() + pendingEnd, pending.begin());
+    pendingEnd -= pendingStart;
+    pendingStart = 0;
+    pendingEnd += ring.pop(pending.data() + pendingEnd, pending.size() - pendingEnd);
+
+    uint64_t frameSamples = sampleRate / Scheduler::FRAME_RATE;
+    if (position + 2 * frameSamples < end) {
+        position = end - frameSamples;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        while (pendingStart < pendingEnd && samplesAt(pending[pendingStart].frame) <= position) {
+            apply(pending[pendingStart++]);
+        }
+        if (on) {
+            unsigned int bit = (unsigned int) phase;
+            out[i] = (pattern[bit / 8] >> (7 - bit % 8)) & 1 ? AMPLITUDE : -AMPLITUDE;
+            phase += step;
+            if (phase >= 128) {
+                phase -= 128;
+            }
+        } else {
+            out[i] = 0;
+        }
+        if (position < end) {
+            ++position;
+        }
+    }
+}
+
+void ToneSynth::apply(const ToneEvent& event) {
+    if (event.on && !on) {
+        phase = 0;
+    }
+    on = event.on;
+    std::memcpy(pattern, event.pattern, sizeof(pattern));
+    step = 4000.0 * std::pow(2.0, (event.pitch - 64) / 48.0) / sampleRate;
+}
+
+uint64_t ToneSynth::samplesAt(uint64_t frame) const {
+    return frame * sampleRate / Scheduler::FRAME_RATE;
+}
+
+WavWriter::~WavWriter() {
+    close();
+}
+
+bool WavWriter::open(const char* path, unsigned int sampleRate) {
+    close();
+
+    file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    sampleCount = 0;
+    failed = false;
+
+    // RIFF header with the sizes left at 0 until close()
+    unsigned char header[44];
+    std::memcpy(header, "RIFF", 4);
+    putU32(header + 4, 0);
+    std::memcpy(header + 8, "WAVEfmt ", 8);
+    putU32(header + 16, 16);
+    putU16(header + 20, 1);                 // PCM
+    putU16(header + 22, 1);                 // Mono
+    putU32(header + 24, sampleRate);
+    putU32(header + 28, sampleRate * 2);    // Bytes per second
+    putU16(header + 32, 2);                 // Bytes per sample
+    putU16(header + 34, 16);                // Bits per sample
+    std::memcpy(header + 36, "data", 4);
+    putU32(header + 40, 0);
+    failed = fwrite(header, 1, sizeof(header), file) != sizeof(header);
+    return true;
+}
+
+void WavWriter::write(const int16_t* samples, size_t count) {
+    unsigned char bytes[2 * 512];
+    while (count > 0) {
+        size_t chunk = count < 512 ? count : 512;
+        for (size_t i = 0; i < chunk; ++i) {
+            putU16(bytes + 2 * i, samples[i]);
+        }
+        if (fwrite(bytes, 2, chunk, file) != chunk) {
+            failed = true;
+        }
+        sampleCount += chunk;
+        samples += chunk;
+        count -= chunk;
+    }
+}
+
+bool WavWriter::close() {
+    if (file == nullptr) {
+        return true;
+    }
+    unsigned char size[4];
+    putU32(size, 36 + sampleCount * 2);
+    if (fseek(file, 4, SEEK_SET) != 0 || fwrite(size, 1, 4, file) != 4) {
+        failed = true;
+    }
+    putU32(size, sampleCount * 2);
+    if (fseek(file, 40, SEEK_SET) != 0 || fwrite(size, 1, 4, file) != 4) {
+        failed = true;
+    }
+    bool ok = fclose(file) == 0 && !failed;
+    file = nullptr;
+    return ok;
+}
@@ -0,0 +1,114 @@
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Sample rate the hosts synthesize at, a whole number of samples per 60 Hz frame
+const unsigned int AUDIO_SAMPLE_RATE = 48000;
+
+// A change of the tone the Chip8 plays, published by Chip8::tickTimers()
+struct ToneEvent {
+    uint64_t frame;                 // Timer tick the tone changed in, counted from the first tick
+    bool on;
+    uint8_t pitch;                  // Pattern playback rate, 4000 * 2^((pitch - 64) / 48) bits per second
+    uint8_t pattern[16];            // 128-bit waveform, most significant bit of the first byte first
+};
+
+// Fixed-size lock-free single producer, single consumer ring of tone changes, plus the number
+// of timer ticks the producer has run, which the consumer paces itself against.
+// The producer never waits: events pushed into a full ring are counted and dropped.
+class ToneRing {
+public:
+    // Capacity is rounded up to a power of two
+    explicit ToneRing(size_t capacity = 256);
+
+    // Producer side. Returns false if the ring was full and the event was dropped.
+    bool push(const ToneEvent& event);
+
+    // Producer side. Publishes that frames timer ticks have run.
+    void setFrame(uint64_t frames);
+
+    // Consumer side. Moves up to max events into out, returns how many.
+    size_t pop(ToneEvent* out, size_t max);
+
+    // Consumer side. Returns the number of timer ticks run.
+    uint64_t getFrame() const;
+
+    // Returns the number of events dropped because the ring was full
+    uint64_t getDroppedCount() const;
+
+    // Returns the number of events the ring holds at most
+    size_t getCapacity() const { return buffer.size(); }
+
+private:
+    std::vector<ToneEvent> buffer;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;       // Next slot the producer writes
+    alignas(64) std::atomic<size_t> tail;       // Next slot the consumer reads
+    alignas(64) std::atomic<uint64_t> frame;
+    std::atomic<uint64_t> dropped;
+};
+
+// Synthesizes the tone changes of a ToneRing into signed 16-bit mono samples, on the audio
+// thread or offline. Samples follow the emulated timer ticks, placing every change at the
+// start of its tick. A tick's changes are published at its end, so playback trails the
+// newest tick, by one frame when rendering a frame's worth after each tick and by at most
+// two on an audio device taking bursts shorter than a frame, about as far as the video
+// trails it. Further behind, after a stall or while fast-forwarding, playback skips ahead;
+// caught up, it holds time still (the waveform keeps running) until the next tick arrives.
+class ToneSynth {
+public:
+    ToneSynth(ToneRing& ring, unsigned int sampleRate);
+
+    // Renders count samples
+    void render(int16_t* out, size_t count);
+
+    unsigned int getSampleRate() const { return sampleRate; }
+
+private:
+    // Switches to the tone of event
+    void apply(const ToneEvent& event);
+
+    // Converts a timer tick to a sample position
+    uint64_t samplesAt(uint64_t frame) const;
+
+    ToneRing& ring;
+    unsigned int sampleRate;
+    std::vector<ToneEvent> pending;     // Changes taken from the ring but not yet reached, sized once
+    size_t pendingStart = 0;            // Next change in pending, and the end of those taken
+    size_t pendingEnd = 0;
+    uint64_t position = 0;              // Emulated time of the next sample, in samples
+    bool on = false;
+    uint8_t pattern[16] = {};
+    double phase = 0;                   // Position in the pattern, in bits
+    double step = 0;                    // Pattern bits per sample
+};
+
+// Writes 16-bit mono PCM samples to a WAV file as they come
+class WavWriter {
+public:
+    WavWriter() = default;
+    ~WavWriter();
+
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    // Creates the file. Returns false if it can't be created.
+    bool open(const char* path, unsigned int sampleRate);
+
+    // Appends count samples
+    void write(const int16_t* samples, size_t count);
+
+    // Fills in the sizes in the header and closes the file. Returns false if any write failed.
+    bool close();
+
+private:
+    FILE* file = nullptr;
+    uint64_t sampleCount = 0;
+    bool failed = false;
+};
+
+#endif //CHIP8_AUDIO_H
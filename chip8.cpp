@@ -1,413 +1,1456 @@
 #include "chip8.h"
-#include <iostream>
-#include <ctime>
-#include <SDL.h>
+#include "audio.h"
+#include "profiler.h"
+#include "rom_cache.h"
+#include "trace.h"
+#include "xorshift.h"
+#include <chrono>
+#include <cstring>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Saved state header: "C8ST", u16 version, u16 reserved
+const char STATE_MAGIC[4] = { 'C', '8', 'S', 'T' };
+const uint16_t STATE_VERSION = 3;
+const size_t STATE_HEADER_SIZE = 8;
+
+// Saved state minus memory and screen, which depend on the platform
+const size_t STATE_FIXED_SIZE = STATE_HEADER_SIZE
+        + 1 + 1 + 1 + 1 // platform, hires, planes, exited
+        + 16            // V
+        + 2 + 2         // I, pc
+        + 16 * 2 + 2    // stack, sp
+        + 1 + 1         // delay_timer, sound_timer
+        + 16            // flags
+        + 16 + 1        // audioPattern, pitch
+        + 16            // key
+        + 2             // opcode
+        + 4;            // rng
+
+// Longest loop body, in bytes before the closing jump, checked for being an idle loop
+const unsigned short MAX_IDLE_LOOP_BYTES = 16;
+
+const char* const FAULT_NAMES[Chip8::FAULT_COUNT] = {
+        "none", "stack overflow", "stack underflow", "unknown opcode"
+};
+
+const char* const FUSION_NAMES[Chip8::FUSION_COUNT] = {
+        "6XNN+6XNN", "ANNN+DXYN", "3XNN+1NNN", "4XNN+1NNN", "7XNN+FX1E", "FX1E+DXYN",
+        "6XNN+00EE", "7XNN+00EE", "DXYN+00EE"
+};
+
+// Tone of the CHIP-8 and SUPER-CHIP buzzer, which has no pattern registers: a 500 Hz square
+// wave, 4 bits high and 4 low at the XO-CHIP default of 4000 bits per second
+const unsigned char BUZZER_PATTERN[16] = {
+        0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0
+};
+const unsigned char BUZZER_PITCH = 64;
+
+// Where loadFontset() puts the big font
+const unsigned short SCHIP_FONT_ADDRESS = 80;
+
+// Memory and screen of each platform
+struct PlatformSpec {
+    const char* name;
+    unsigned int memorySize;
+    unsigned int planes;        // Bitplanes
+    unsigned int rows;          // Screen rows in use at most, and saved in a state
+    unsigned int rowWords;      // Words in use per row
+    Chip8::Quirks quirks;       // Default quirks
+};
+
+const PlatformSpec PLATFORMS[Chip8::PLATFORM_COUNT] = {
+        { "chip8",  4096,  1, 32, 1, Chip8::QUIRKS_MODERN },
+        { "schip",  4096,  1, 64, 2, Chip8::QUIRKS_SCHIP },
+        { "xochip", 65536, 2, 64, 2, Chip8::QUIRKS_XOCHIP },
+};
+
+const char* const QUIRKS_NAMES[Chip8::QUIRKS_COUNT] = { "cosmac", "modern", "schip", "xochip" };
+
+// Rotates a row of width 64 or 128 pixels right by shift, wrapping around the right edge.
+// The row is left:right with the leftmost pixel in the top bit of left; right stays 0 at width 64.
+inline void rotateRow(uint64_t& left, uint64_t& right, unsigned int shift, unsigned int width) {
+    if (width == 64) {
+        left = (left >> shift) | (left << ((64 - shift) & 63));
+        return;
+    }
+    if (shift >= 64) {
+        std::swap(left, right);
+        shift -= 64;
+    }
+    if (shift != 0) {
+        uint64_t l = (left >> shift) | (right << (64 - shift));
+        right = (right >> shift) | (left << (64 - shift));
+        left = l;
+    }
+}
+
+// Shifts a row of width 64 or 128 pixels right by shift, dropping what passes the right edge.
+// Same layout as rotateRow().
+inline void shiftRow(uint64_t& left, uint64_t& right, unsigned int shift, unsigned int width) {
+    if (width == 64) {
+        left >>= shift;
+    } else if (shift >= 64) {
+        right = left >> (shift - 64);
+        left = 0;
+    } else if (shift != 0) {
+        right = (right >> shift) | (left << (64 - shift));
+        left >>= shift;
+    }
+}
+
+// Little-endian field writer for saveState()
+class StateWriter {
+public:
+    explicit StateWriter(unsigned char* out) : out(out) {}
+
+    void bytes(const unsigned char* data, size_t size) { std::memcpy(out, data, size); out += size; }
+    void u8(unsigned char value) { *out++ = value; }
+    void u16(uint16_t value) { u8(value & 0xFF); u8(value >> 8); }
+    void u32(uint32_t value) { u16(value & 0xFFFF); u16(value >> 16); }
+    void u64(uint64_t value) { u32(value & 0xFFFFFFFF); u32(value >> 32); }
+
+private:
+    unsigned char* out;
+};
+
+// Little-endian field reader for loadState()
+class StateReader {
+public:
+    explicit StateReader(const unsigned char* in) : in(in) {}
+
+    void bytes(unsigned char* data, size_t size) { std::memcpy(data, in, size); in += size; }
+    unsigned char u8() { return *in++; }
+    uint16_t u16() { uint16_t low = u8(); return low | (u8() << 8); }
+    uint32_t u32() { uint32_t low = u16(); return low | ((uint32_t) u16() << 16); }
+    uint64_t u64() { uint64_t low = u32(); return low | ((uint64_t) u32() << 32); }
+
+private:
+    const unsigned char* in;
+};
+
+}
+
+const unsigned char Chip8::chip8_fontset[80] =
+        {
+                0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+                0x20, 0x60, 0x20, 0x20, 0x70, // 1
+                0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+                0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+                0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+                0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+                0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+                0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+                0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+                0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+                0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+                0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+                0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+                0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+                0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+                0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+        };
+
+const unsigned char Chip8::schip_fontset[160] =
+        {
+                0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+                0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+                0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+                0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+                0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+                0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+                0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+                0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+                0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+                0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+                0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+                0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+        };
+
+constexpr Chip8::QuirkSpec Chip8::QUIRK_SPECS[];
+
+template <Chip8::Quirks Q>
+Chip8::QuirkHandlers Chip8::quirkHandlers() {
+    QuirkHandlers handlers = {
+            &Chip8::op8XY1<Q>, &Chip8::op8XY2<Q>, &Chip8::op8XY3<Q>, &Chip8::op8XY6<Q>, &Chip8::op8XYE<Q>,
+            &Chip8::opBNNN<Q>, &Chip8::opDXYN<Q>, &Chip8::opDXYNExtended<Q>, &Chip8::opFX55<Q>,
+            &Chip8::opFX65<Q>, &Chip8::fusedHandler<Q>
+    };
+    return handlers;
+}
+
+const Chip8::QuirkHandlers Chip8::QUIRK_HANDLERS[QUIRKS_COUNT] = {
+        quirkHandlers<QUIRKS_COSMAC>(),
+        quirkHandlers<QUIRKS_MODERN>(),
+        quirkHandlers<QUIRKS_SCHIP>(),
+        quirkHandlers<QUIRKS_XOCHIP>(),
+};
+
+void Chip8::initialize(uint32_t seed, Platform platform) {
+    initialize(seed, platform, defaultQuirks(platform));
+}
+
+void Chip8::initialize(uint32_t seed, Platform platform, Quirks quirks) {
+    // clearMemory() below drops every decode made for other quirks
+    this->platform = platform;
+    this->quirks = quirks;
+    addressMask = PLATFORMS[platform].memorySize - 1;
+    if (memory.size() != PLATFORMS[platform].memorySize) {
+        memory.assign(PLATFORMS[platform].memorySize, 0);
+        decoded.assign(PLATFORMS[platform].memorySize, Instruction());
+        ++codeGeneration;
+    }
 
-void Chip8::initialize() {
     pc = 0x200;     // PC starts at 0x200 on chip-8
     opcode = 0;     // Reset current opcode
     I = 0;          // Reset index register
     sp = 0;         // Reset stack pointer
+    waitingForKey = false;
+    exited = false;
+    fault = FAULT_NONE;
+    loopPassed = false;
+    loopSnapshot = false;
+    idleSkipped = 0;
+    for (int i = 0; i < FUSION_COUNT; ++i) {
+        fusionDispatches[i] = 0;
+        fusionHits[i] = 0;
+    }
+    hires = false;  // Every platform starts in 64x32 with plane 0 selected
+    planes = 0x1;
+    pitch = 64;     // XO-CHIP default pitch, 4000 Hz
+    for (int i = 0; i < 16; ++i) {
+        flags[i] = 0;
+        audioPattern[i] = 0;
+    }
     drawFlag = true;// Reset draw flag
+    delay_timer = 0;// Reset timers
+    sound_timer = 0;
 
-    std::srand(std::time(nullptr));
+    rng = xorshiftSeed(seed);
 
     clearDisplay();
     clearStack();
     clearRegisters();
     clearMemory();
     loadFontset();
+    clearKeys();
 
 }
 
 void Chip8::emulateCycle() {
+    // Halted in Fx0A, setKeys() resumes
+    if (waitingForKey) {
+        return;
+    }
+
+    // Fetch the predecoded instruction, decoding it on first use
+    Instruction& instruction = decoded[pc & addressMask];
+    if (instruction.handler == nullptr) {
+        decode(pc & addressMask, instruction);
+    }
+    opcode = instruction.opcode;
+
+#if defined(CHIP8_TRACE) || defined(CHIP8_PROFILE)
+    if (traceRing != nullptr || profiler != nullptr) {
+        instrumentedCycle(instruction);
+        return;
+    }
+#endif
+
+    // Execute
+    instruction.handler(*this, instruction);
+}
+
+unsigned int Chip8::run(unsigned int budget) {
+    // Instrumentation records one instruction per cycle, so superinstructions run one half there
+    fusing = fusionEnabled && traceRing == nullptr && profiler == nullptr;
+    runCycles = 0;
+    while (runCycles < budget && !waitingForKey && fault == FAULT_NONE) {
+        // Handlers cut the limit to hand control back here: Fx0A on halting, op1NNNLoop at a loop pass
+        cycleLimit = budget;
+        while (runCycles < cycleLimit) {
+            emulateCycle();
+            ++runCycles;
+        }
+        runCycles = skipIdleLoop(runCycles, budget);
+    }
+    fusing = false;
+    return runCycles;
+}
+
+unsigned int Chip8::skipIdleLoop(unsigned int executed, unsigned int budget) {
+    if (!loopPassed) {
+        return executed;
+    }
+    loopPassed = false;
+    if (!idleLoopSkipping || traceRing != nullptr || profiler != nullptr) {
+        return executed;
+    }
+
+    // Back at the same head with the same registers, stack and delay timer as on the last pass.
+    // That iteration may have left the body through a skip over the closing jump and run anything
+    // before coming back, so only a pass straight through the body that changes nothing proves
+    // the next ones will repeat it.
+    if (loopSnapshot && loopHead == pc && loopI == I && loopSp == sp && loopDelay == delay_timer &&
+        std::memcmp(loopV, V, sizeof(V)) == 0 && executed < budget && isSideEffectFree(pc, loopEnd)) {
+        unsigned int length = idlePassLength();
+        if (length != 0) {
+            unsigned int skipped = (budget - executed) / length * length;
+            idleSkipped += skipped;
+            executed += skipped;
+        }
+    }
+
+    loopSnapshot = true;
+    loopHead = pc;
+    loopI = I;
+    loopSp = sp;
+    loopDelay = delay_timer;
+    std::memcpy(loopV, V, sizeof(V));
+    return executed;
+}
+
+unsigned int Chip8::idlePassLength() {
+    unsigned short head = pc;
+    unsigned short savedI = I;
+    unsigned char savedV[16];
+    std::memcpy(savedV, V, sizeof(V));
+
+    // The body's handlers only change pc, V and I, and only move pc forward
+    unsigned int length = 0;
+    while (pc >= head && pc < loopEnd) {
+        Instruction in;
+        decode(pc & addressMask, in, false);
+        in.handler(*this, in);
+        ++length;
+    }
+    bool idle = pc == loopEnd && I == savedI && std::memcmp(savedV, V, sizeof(V)) == 0;
+
+    pc = head;
+    I = savedI;
+    std::memcpy(V, savedV, sizeof(V));
+    return idle ? length + 1 : 0;
+}
+
+bool Chip8::isSideEffectFree(unsigned short first, unsigned short last) {
+    if (first > last || last - first > MAX_IDLE_LOOP_BYTES) {
+        return false;
+    }
+    for (unsigned int address = first; address < last; address += 2) {
+        // Jumps and calls leave the body; checked before decoding, which would look at their targets
+        unsigned char family = memory[address & addressMask] >> 4;
+        if (family == 0x1 || family == 0x2 || family == 0xB) {
+            return false;
+        }
+        Instruction in;
+        decode(address & addressMask, in, false);
+        Handler h = in.handler;
+        const QuirkHandlers& q = QUIRK_HANDLERS[quirks];
+        bool pure = h == &Chip8::op3XNN || h == &Chip8::op4XNN || h == &Chip8::op5XY0 ||
+                    h == &Chip8::op9XY0 || h == &Chip8::op6XNN || h == &Chip8::op7XNN ||
+                    h == &Chip8::op8XY0 || h == q.op8XY1 || h == q.op8XY2 ||
+                    h == q.op8XY3 || h == &Chip8::op8XY4 || h == &Chip8::op8XY5 ||
+                    h == q.op8XY6 || h == &Chip8::op8XY7 || h == q.op8XYE ||
+                    h == &Chip8::opANNN || h == &Chip8::opEX9E || h == &Chip8::opEXA1 ||
+                    h == &Chip8::opFX07 || h == &Chip8::opFX1E || h == &Chip8::opFX29 ||
+                    h == &Chip8::opFX30 || h == q.opFX65 || h == &Chip8::op5XY3 ||
+                    h == &Chip8::opFX85;
+        if (!pure) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Chip8::setIdleLoopSkipping(bool enabled) {
+    idleLoopSkipping = enabled;
+}
+
+uint64_t Chip8::getIdleSkippedCount() const {
+    return idleSkipped;
+}
+
+void Chip8::setFusion(bool enabled) {
+    fusionEnabled = enabled;
+}
+
+const char* Chip8::faultName(Fault fault) {
+    return FAULT_NAMES[fault];
+}
+
+const char* Chip8::fusionName(Fusion fusion) {
+    return FUSION_NAMES[fusion];
+}
+
+uint64_t Chip8::getFusionDispatchCount(Fusion fusion) const {
+    return fusionDispatches[fusion];
+}
+
+uint64_t Chip8::getFusionHitCount(Fusion fusion) const {
+    return fusionHits[fusion];
+}
+
+void Chip8::instrumentedCycle(const Instruction& instruction) {
+    unsigned short address = pc;
+#ifdef CHIP8_TRACE
+    unsigned char before[16];
+    std::memcpy(before, V, sizeof(before));
+#endif
+
+#ifdef CHIP8_PROFILE
+    if (profiler != nullptr) {
+        profiler->onInstruction(address, instruction.opcode);
+    }
+#endif
+
+    instruction.handler(*this, instruction);
+
+#ifdef CHIP8_PROFILE
+    if (profiler != nullptr) {
+        // By opcode, the handler may be a superinstruction starting with the draw
+        if ((instruction.opcode & 0xF000) == 0xD000) {
+            profiler->onDraw(V[0xF] != 0);
+        } else if (waitingForKey) {
+            // Reported by setKeys() once a key ends the wait
+            keyWaitStart = std::chrono::steady_clock::now();
+        }
+    }
+#endif
+
+#ifdef CHIP8_TRACE
+    if (traceRing != nullptr) {
+        TraceRecord record;
+        record.pc = address;
+        record.opcode = instruction.opcode;
+        record.I = I;
+
+        // Report the lowest changed register, so VF only if nothing else changed
+        record.reg = TRACE_NO_REGISTER;
+        record.value = 0;
+        for (int i = 0; i < 16; ++i) {
+            if (V[i] != before[i]) {
+                record.reg = i;
+                record.value = V[i];
+                break;
+            }
+        }
+
+        traceRing->push(record);
+    }
+#endif
+}
+
+void Chip8::tickTimers() {
+    // Loops reading the timers may take another path now
+    loopSnapshot = false;
+
+    if (delay_timer > 0) {
+        --delay_timer;
+    }
+
+    // The tone plays through every tick that starts with the sound timer running
+    if (toneRing != nullptr) {
+        bool on = sound_timer > 0;
+        bool xo = platform == PLATFORM_XOCHIP;
+        const unsigned char* pattern = xo ? audioPattern : BUZZER_PATTERN;
+        unsigned char rate = xo ? pitch : BUZZER_PITCH;
+        if (on != toneOn || (on && (rate != tonePitch || std::memcmp(pattern, tonePattern, 16) != 0))) {
+            ToneEvent event;
+            event.frame = timerTicks;
+            event.on = on;
+            event.pitch = rate;
+            std::memcpy(event.pattern, pattern, 16);
+            if (toneRing->push(event)) {
+                toneOn = on;
+                tonePitch = rate;
+                std::memcpy(tonePattern, pattern, 16);
+            }
+        }
+    }
+
+    if (sound_timer > 0) {
+        --sound_timer;
+    }
+
+    ++timerTicks;
+    if (toneRing != nullptr) {
+        toneRing->setFrame(timerTicks);
+    }
+}
+
+void Chip8::decode(unsigned short address, Instruction& instruction, bool fuse) {
     // Fetch opcode
-    opcode = memory[pc] << 8 | memory[pc + 1];
+    unsigned short op = memory[address] << 8 | memory[(address + 1) & addressMask];
+    bool extended = platform != PLATFORM_CHIP8;
+    bool xo = platform == PLATFORM_XOCHIP;
+    const QuirkHandlers& q = QUIRK_HANDLERS[quirks];
+
+    // Pre-extract the operands, every handler picks the ones it needs
+    instruction.opcode = op;
+    instruction.x = (op & 0x0F00) >> 8;
+    instruction.y = (op & 0x00F0) >> 4;
+    instruction.n = op & 0x000F;
+    instruction.nn = op & 0x00FF;
+    instruction.nnn = op & 0x0FFF;
 
     // Decode opcode
     // First, look on the first nibble (4 bits)
-    switch (opcode & 0xF000) {
+    Handler handler = &Chip8::opUnknown;
+    switch (op & 0xF000) {
         case 0x0000: // 0x00E0 or 0x00EE, display_clear or subroutine return
-            // Check the latest nibble
-            switch (opcode & 0x000F) {
-                case 0x0000: // 0x00E0, display_clear()
-                    clearDisplay();
-                    break;
-                case 0x000E: // 0x00EE, subroutine return
-                {
-                    --sp;
-                    pc = stack[sp];
-                    pc += 2;
-                    break;
+            if (extended) {
+                // SUPER-CHIP packs scrolling and the display mode in here, so match whole opcodes
+                switch (op & 0xFFF0) {
+                    case 0x00C0: handler = &Chip8::op00CN; break;
+                    case 0x00D0: handler = xo ? &Chip8::op00DN : &Chip8::opUnknown; break;
                 }
-                default:
-                    std::cout << "Unknown opcode [0x0000]: 0x" << std::uppercase << std::hex << opcode << "\n" ;
+                switch (op) {
+                    case 0x00E0: handler = &Chip8::op00E0; break;
+                    case 0x00EE: handler = &Chip8::op00EE; break;
+                    case 0x00FB: handler = &Chip8::op00FB; break;
+                    case 0x00FC: handler = &Chip8::op00FC; break;
+                    case 0x00FD: handler = &Chip8::op00FD; break;
+                    case 0x00FE: handler = &Chip8::op00FE; break;
+                    case 0x00FF: handler = &Chip8::op00FF; break;
+                }
+                break;
+            }
+            // Check the latest nibble
+            switch (op & 0x000F) {
+                case 0x0000: handler = &Chip8::op00E0; break;
+                case 0x000E: handler = &Chip8::op00EE; break;
             }
             break;
-        case 0x1000: // 0x1NNN, Jump to NNN
-        {
-            pc = opcode & 0x0FFF;
+        case 0x1000:
+            // A short backward jump over instructions without side effects may close an idle loop
+            handler = (op & 0x0FFF) <= address && isSideEffectFree(op & 0x0FFF, address)
+                      ? &Chip8::op1NNNLoop : &Chip8::op1NNN;
             break;
-        }
-        case 0x2000: // 0x2NNN, Subroutine call at NNN
-        {
-            stack[sp] = pc;
-            ++sp;
-            pc = opcode & 0x0FFF;
+        case 0x2000: handler = &Chip8::op2NNN; break;
+        case 0x3000: handler = &Chip8::op3XNN; break;
+        case 0x4000: handler = &Chip8::op4XNN; break;
+        case 0x5000:
+            switch (xo ? op & 0x000F : 0) {
+                case 0x0002: handler = &Chip8::op5XY2; break;
+                case 0x0003: handler = &Chip8::op5XY3; break;
+                default: handler = &Chip8::op5XY0; break;
+            }
             break;
-        }
-        case 0x3000: // 0x3XNN, If (Vx==NN), skip the next instr. if VX==NN
-        {
-            if (V[(opcode & 0x0FFF) >> 8] == (opcode & 0x00FF)) {
-                pc += 4;
-            } else {
-                pc += 2;
+        case 0x6000: handler = &Chip8::op6XNN; break;
+        case 0x7000: handler = &Chip8::op7XNN; break;
+        case 0x8000: // 0x8XY*, several different cases
+            switch (op & 0x000F) {
+                case 0x0000: handler = &Chip8::op8XY0; break;
+                case 0x0001: handler = q.op8XY1; break;
+                case 0x0002: handler = q.op8XY2; break;
+                case 0x0003: handler = q.op8XY3; break;
+                case 0x0004: handler = &Chip8::op8XY4; break;
+                case 0x0005: handler = &Chip8::op8XY5; break;
+                case 0x0006: handler = q.op8XY6; break;
+                case 0x0007: handler = &Chip8::op8XY7; break;
+                case 0x000E: handler = q.op8XYE; break;
             }
             break;
-        }
-        case 0x4000: // 0x4XNN, if (Vx!=NN)
-        {
-            if (V[(opcode & 0x0FFF) >> 8] != (opcode & 0x00FF)) {
-                pc += 4;
-            } else {
-                pc += 2;
+        case 0x9000: handler = &Chip8::op9XY0; break;
+        case 0xA000: handler = &Chip8::opANNN; break;
+        case 0xB000: handler = q.opBNNN; break;
+        case 0xC000: handler = &Chip8::opCXNN; break;
+        case 0xD000: handler = extended ? q.opDXYNExtended : q.opDXYN; break;
+        case 0xE000: // 0xEX9E or 0xEXA1
+            switch (op & 0x000F) {
+                case 0x000E: handler = &Chip8::opEX9E; break;
+                case 0x0001: handler = &Chip8::opEXA1; break;
             }
             break;
-        }
-        case 0x5000: // 0x5XY0, skip next instruction if (Vx==Vy)
-        {
-            if (V[(opcode & 0x0FFF) >> 8] == V[((opcode & 0x00FF) >> 4)]) {
-                pc += 4;
-            } else {
-                pc += 2;
+        case 0xF000:
+            if (xo && op == 0xF000) {
+                // 4-byte instruction, the address is the next word
+                handler = &Chip8::opF000;
+                instruction.nnn = memory[(address + 2) & addressMask] << 8 | memory[(address + 3) & addressMask];
+                break;
+            }
+            if (xo && op == 0xF002) {
+                handler = &Chip8::opF002;
+                break;
+            }
+            switch (op & 0x00FF) {
+                case 0x0001: if (xo) handler = &Chip8::opFN01; break;
+                case 0x0030: if (extended) handler = &Chip8::opFX30; break;
+                case 0x003A: if (xo) handler = &Chip8::opFX3A; break;
+                case 0x0075: if (extended) handler = &Chip8::opFX75; break;
+                case 0x0085: if (extended) handler = &Chip8::opFX85; break;
+                case 0x0007: handler = &Chip8::opFX07; break;
+                case 0x000A: handler = &Chip8::opFX0A; break;
+                case 0x0015: handler = &Chip8::opFX15; break;
+                case 0x0018: handler = &Chip8::opFX18; break;
+                case 0x001E: handler = &Chip8::opFX1E; break;
+                case 0x0029: handler = &Chip8::opFX29; break;
+                case 0x0033: handler = &Chip8::opFX33; break;
+                case 0x0055: handler = q.opFX55; break;
+                case 0x0065: handler = q.opFX65; break;
             }
             break;
+    }
+
+    // An XO-CHIP skip over F000 NNNN has to step over all 4 bytes of it
+    if (xo && memory[(address + 2) & addressMask] == 0xF0 && memory[(address + 3) & addressMask] == 0x00) {
+        if (handler == &Chip8::op3XNN) handler = &Chip8::opLongSkip<&Chip8::op3XNN>;
+        if (handler == &Chip8::op4XNN) handler = &Chip8::opLongSkip<&Chip8::op4XNN>;
+        if (handler == &Chip8::op5XY0) handler = &Chip8::opLongSkip<&Chip8::op5XY0>;
+        if (handler == &Chip8::op9XY0) handler = &Chip8::opLongSkip<&Chip8::op9XY0>;
+        if (handler == &Chip8::opEX9E) handler = &Chip8::opLongSkip<&Chip8::opEX9E>;
+        if (handler == &Chip8::opEXA1) handler = &Chip8::opLongSkip<&Chip8::opEXA1>;
+    }
+
+    // A common pair runs as one superinstruction, which takes the operands of its second
+    // half from the cache entry after it
+    if (fuse) {
+        unsigned short next = (address + 2) & addressMask;
+        Instruction following;
+        decode(next, following, false);
+        Handler fused = q.fused(handler, following.handler);
+        if (fused != nullptr) {
+            handler = fused;
+            if (decoded[next].handler == nullptr) {
+                decoded[next] = following;
+            }
         }
-        case 0x6000: // 0x6XNN, sets Vx = NN
-        {
-            V[(opcode & 0x0FFF) >> 8] = (opcode & 0x00FF);
-            pc += 2;
-            break;
+    }
+    instruction.handler = handler;
+}
+
+template <Chip8::Quirks Q>
+Chip8::Handler Chip8::fusedHandler(Handler first, Handler second) {
+    struct Pair {
+        Handler first;
+        Handler second;
+        Handler fused;
+    };
+    static const Pair PAIRS[] = {
+            { &Chip8::op6XNN, &Chip8::op6XNN, &Chip8::opFused<&Chip8::op6XNN, &Chip8::op6XNN, FUSION_6XNN_6XNN> },
+            { &Chip8::opANNN, &Chip8::opDXYN<Q>, &Chip8::opFused<&Chip8::opANNN, &Chip8::opDXYN<Q>, FUSION_ANNN_DXYN> },
+            { &Chip8::opANNN, &Chip8::opDXYNExtended<Q>,
+              &Chip8::opFused<&Chip8::opANNN, &Chip8::opDXYNExtended<Q>, FUSION_ANNN_DXYN> },
+            { &Chip8::op3XNN, &Chip8::op1NNN, &Chip8::opFused<&Chip8::op3XNN, &Chip8::op1NNN, FUSION_3XNN_1NNN> },
+            { &Chip8::op3XNN, &Chip8::op1NNNLoop,
+              &Chip8::opFused<&Chip8::op3XNN, &Chip8::op1NNNLoop, FUSION_3XNN_1NNN> },
+            { &Chip8::op4XNN, &Chip8::op1NNN, &Chip8::opFused<&Chip8::op4XNN, &Chip8::op1NNN, FUSION_4XNN_1NNN> },
+            { &Chip8::op4XNN, &Chip8::op1NNNLoop,
+              &Chip8::opFused<&Chip8::op4XNN, &Chip8::op1NNNLoop, FUSION_4XNN_1NNN> },
+            { &Chip8::op7XNN, &Chip8::opFX1E, &Chip8::opFused<&Chip8::op7XNN, &Chip8::opFX1E, FUSION_7XNN_FX1E> },
+            { &Chip8::opFX1E, &Chip8::opDXYN<Q>, &Chip8::opFused<&Chip8::opFX1E, &Chip8::opDXYN<Q>, FUSION_FX1E_DXYN> },
+            { &Chip8::opFX1E, &Chip8::opDXYNExtended<Q>,
+              &Chip8::opFused<&Chip8::opFX1E, &Chip8::opDXYNExtended<Q>, FUSION_FX1E_DXYN> },
+            { &Chip8::op6XNN, &Chip8::op00EE, &Chip8::opFused<&Chip8::op6XNN, &Chip8::op00EE, FUSION_6XNN_00EE> },
+            { &Chip8::op7XNN, &Chip8::op00EE, &Chip8::opFused<&Chip8::op7XNN, &Chip8::op00EE, FUSION_7XNN_00EE> },
+            { &Chip8::opDXYN<Q>, &Chip8::op00EE, &Chip8::opFused<&Chip8::opDXYN<Q>, &Chip8::op00EE, FUSION_DXYN_00EE> },
+            { &Chip8::opDXYNExtended<Q>, &Chip8::op00EE,
+              &Chip8::opFused<&Chip8::opDXYNExtended<Q>, &Chip8::op00EE, FUSION_DXYN_00EE> },
+    };
+    for (const Pair& pair : PAIRS) {
+        if (pair.first == first && pair.second == second) {
+            return pair.fused;
         }
-        case 0x7000: // 0x7XNN, Vx += NN (carry flag not changed)
-        {
-            V[(opcode & 0x0FFF) >> 8] += (opcode & 0x00FF);
-            pc += 2;
-            break;
+    }
+    return nullptr;
+}
+
+void Chip8::invalidateDecoded(unsigned int address, unsigned int length) {
+    // Writes wrap around the end of memory
+    unsigned int size = addressMask + 1;
+    if (address + length > size) {
+        invalidateDecoded(0, address + length - size);
+        length = size - address;
+    }
+
+    // Decodes read up to 4 bytes: superinstructions, F000 NNNN, and XO-CHIP skips looking for
+    // one after them. The instructions starting up to 3 bytes earlier go too.
+    unsigned int reach = 3;
+    unsigned int first = address > reach ? address - reach : 0;
+    unsigned int last = address + length;
+    bool dropped = false;
+    for (unsigned int it = first; it < last; ++it) {
+        dropped |= decoded[it].handler != nullptr;
+        decoded[it].handler = nullptr;
+    }
+    if (dropped) {
+        ++codeGeneration;
+    }
+}
+
+void Chip8::opUnknown(Chip8& c, const Instruction&) {
+    c.stop(FAULT_UNKNOWN_OPCODE);
+}
+
+void Chip8::op00E0(Chip8& c, const Instruction&) {
+    // 0x00E0, display_clear() of the selected planes
+    c.clearPlanes(c.planes);
+    c.pc += 2;
+}
+
+void Chip8::op00EE(Chip8& c, const Instruction&) {
+    // 0x00EE, subroutine return
+    if (c.sp == 0) {
+        c.stop(FAULT_STACK_UNDERFLOW);
+        return;
+    }
+    --c.sp;
+    c.pc = c.stack[c.sp];
+    c.pc += 2;
+}
+
+void Chip8::op1NNN(Chip8& c, const Instruction& in) {
+    // 0x1NNN, Jump to NNN
+    c.pc = in.nnn;
+}
+
+void Chip8::op1NNNLoop(Chip8& c, const Instruction& in) {
+    // 0x1NNN closing a loop without side effects. Stops run() so it can check for an idle loop.
+    c.loopEnd = c.pc;
+    c.pc = in.nnn;
+    c.loopPassed = true;
+    c.cycleLimit = 0;
+}
+
+void Chip8::op2NNN(Chip8& c, const Instruction& in) {
+    // 0x2NNN, Subroutine call at NNN
+    if (c.sp == 16) {
+        c.stop(FAULT_STACK_OVERFLOW);
+        return;
+    }
+    c.stack[c.sp] = c.pc;
+    ++c.sp;
+    c.pc = in.nnn;
+}
+
+void Chip8::op3XNN(Chip8& c, const Instruction& in) {
+    // 0x3XNN, If (Vx==NN), skip the next instr. if VX==NN
+    c.pc += (c.V[in.x] == in.nn) ? 4 : 2;
+}
+
+void Chip8::op4XNN(Chip8& c, const Instruction& in) {
+    // 0x4XNN, if (Vx!=NN)
+    c.pc += (c.V[in.x] != in.nn) ? 4 : 2;
+}
+
+void Chip8::op5XY0(Chip8& c, const Instruction& in) {
+    // 0x5XY0, skip next instruction if (Vx==Vy)
+    c.pc += (c.V[in.x] == c.V[in.y]) ? 4 : 2;
+}
+
+void Chip8::op6XNN(Chip8& c, const Instruction& in) {
+    // 0x6XNN, sets Vx = NN
+    c.V[in.x] = in.nn;
+    c.pc += 2;
+}
+
+void Chip8::op7XNN(Chip8& c, const Instruction& in) {
+    // 0x7XNN, Vx += NN (carry flag not changed)
+    c.V[in.x] += in.nn;
+    c.pc += 2;
+}
+
+void Chip8::op8XY0(Chip8& c, const Instruction& in) {
+    // Assign Vx to the value of Vy
+    c.V[in.x] = c.V[in.y];
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::op8XY1(Chip8& c, const Instruction& in) {
+    // Sets Vx = Vx|Vy, bitwise OR. The COSMAC VIP left VF 0.
+    c.V[in.x] |= c.V[in.y];
+    if (QUIRK_SPECS[Q].vfReset) {
+        c.V[0xF] = 0;
+    }
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::op8XY2(Chip8& c, const Instruction& in) {
+    // Sets Vx = Vx&Vy
+    c.V[in.x] &= c.V[in.y];
+    if (QUIRK_SPECS[Q].vfReset) {
+        c.V[0xF] = 0;
+    }
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::op8XY3(Chip8& c, const Instruction& in) {
+    // Sets Vx = Vx^Vy, Vx to Vx xor Vy
+    c.V[in.x] ^= c.V[in.y];
+    if (QUIRK_SPECS[Q].vfReset) {
+        c.V[0xF] = 0;
+    }
+    c.pc += 2;
+}
+
+void Chip8::op8XY4(Chip8& c, const Instruction& in) {
+    // Vx += Vy, VF is set to 1 when there's a carry, and to 0 when there isn't.
+    unsigned char carry = (c.V[in.y] > (0xFF - c.V[in.x])) ? 1 : 0;
+    c.V[in.x] += c.V[in.y];
+    c.V[0xF] = carry;
+    c.pc += 2;
+}
+
+void Chip8::op8XY5(Chip8& c, const Instruction& in) {
+    // Vx -= Vy, VF is set to 0 when there's a borrow, and 1 when there isn't.
+    unsigned char noBorrow = (c.V[in.y] > c.V[in.x]) ? 0 : 1;
+    c.V[in.x] -= c.V[in.y];
+    c.V[0xF] = noBorrow;
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::op8XY6(Chip8& c, const Instruction& in) {
+    // Vx >>=1, Stores the least significant bit of VX in VF and then shifts VX to the right by 1.
+    // The COSMAC VIP and XO-CHIP shift VY into VX instead.
+    unsigned char source = c.V[QUIRK_SPECS[Q].shiftVy ? in.y : in.x];
+    c.V[in.x] = source >> 1;
+    c.V[0xF] = source & 0x1;
+    c.pc += 2;
+}
+
+void Chip8::op8XY7(Chip8& c, const Instruction& in) {
+    // Vx=Vy-Vx, VF is set to 0 when there's a borrow, and 1 when there isn't.
+    unsigned char noBorrow = (c.V[in.x] > c.V[in.y]) ? 0 : 1;
+    c.V[in.x] = c.V[in.y] - c.V[in.x];
+    c.V[0xF] = noBorrow;
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::op8XYE(Chip8& c, const Instruction& in) {
+    // Vx<<=1, Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
+    // The COSMAC VIP and XO-CHIP shift VY into VX instead.
+    unsigned char source = c.V[QUIRK_SPECS[Q].shiftVy ? in.y : in.x];
+    c.V[in.x] = source << 1;
+    c.V[0xF] = source >> 7;
+    c.pc += 2;
+}
+
+void Chip8::op9XY0(Chip8& c, const Instruction& in) {
+    // 0x9XY0, skips the next instruction if VX doesn't equal VY
+    c.pc += (c.V[in.x] != c.V[in.y]) ? 4 : 2;
+}
+
+void Chip8::opANNN(Chip8& c, const Instruction& in) {
+    // 0xANNN, sets I to the address NNN
+    c.I = in.nnn;
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::opBNNN(Chip8& c, const Instruction& in) {
+    // 0xBNNN, jump to address NNN plus V0. SUPER-CHIP reads it as BXNN, XNN plus VX.
+    c.pc = in.nnn + c.V[QUIRK_SPECS[Q].jumpVx ? in.x : 0];
+}
+
+void Chip8::opCXNN(Chip8& c, const Instruction& in) {
+    // 0xCXNN, Vx=rand()&NN
+    c.V[in.x] = xorshiftByte(c.rng) & in.nn;
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::opDXYN(Chip8& c, const Instruction& in) {
+    // 0xDXYN, draw(Vx, Vy, N)
+    // Each 8px sprite line is rotated into place and XORed into its screen row in one go,
+    // wrapping around the screen edges, or shifted into place and cut off at them when clipping.
+    unsigned int x = c.V[in.x] & 63;    // Coordinate x
+    unsigned int y = c.V[in.y] & 31;    // Coordinate y
+    unsigned int lines = QUIRK_SPECS[Q].clip && y + in.n > 32 ? 32 - y : in.n;
+    uint64_t collision = 0;
+
+    for (unsigned int yline = 0; yline < lines; yline++) {
+        uint64_t sprite = (uint64_t) c.memory[(c.I + yline) & c.addressMask] << 56;
+        sprite = QUIRK_SPECS[Q].clip ? sprite >> x : (sprite >> x) | (sprite << ((64 - x) & 63));
+        uint64_t& row = c.gfx[0][(y + yline) & 31][0];
+        c.dirtyRows |= 1ull << ((y + yline) & 31);
+        collision |= row & sprite;      // Pixels that were already 1
+        row ^= sprite;                  // XOR mode drawing
+    }
+
+    c.V[0xF] = collision != 0 ? 1 : 0;
+    c.drawFlag = true;
+    c.gfxBytesStale = true;
+    c.pc += 2;
+}
+
+void Chip8::opEX9E(Chip8& c, const Instruction& in) {
+    // Skips the next instruction if the key stored in VX is pressed.
+    // (Usually the next instruction is a jump to skip a code block)
+    c.pc += ((c.keys >> (c.V[in.x] & 0xF)) & 1) != 0 ? 4 : 2;
+}
+
+void Chip8::opEXA1(Chip8& c, const Instruction& in) {
+    // Skips the next instruction if the key stored in VX isn't pressed.
+    // (Usually the next instruction is a jump to skip a code block)
+    c.pc += ((c.keys >> (c.V[in.x] & 0xF)) & 1) == 0 ? 4 : 2;
+}
+
+void Chip8::opFX07(Chip8& c, const Instruction& in) {
+    // Vx = get_delay()	Sets VX to the value of the delay timer.
+    c.V[in.x] = c.delay_timer;
+    c.pc += 2;
+}
+
+void Chip8::opFX0A(Chip8& c, const Instruction& in) {
+    // Vx = get_key()	A key press is awaited, and then stored in VX.
+    // (Halts the CPU until the next key event, pc stays here so the instruction runs again then)
+    if (c.keys != 0) {
+        c.V[in.x] = __builtin_ctz(c.keys);     // Lowest pressed key
+        c.pc += 2;
+        return;
+    }
+    c.waitingForKey = true;
+    c.cycleLimit = 0;
+}
+
+void Chip8::opFX15(Chip8& c, const Instruction& in) {
+    // delay_timer(Vx)	Sets the delay timer to VX.
+    c.delay_timer = c.V[in.x];
+    c.pc += 2;
+}
+
+void Chip8::opFX18(Chip8& c, const Instruction& in) {
+    // sound_timer(Vx)	Sets the sound timer to VX.
+    c.sound_timer = c.V[in.x];
+    c.pc += 2;
+}
+
+void Chip8::opFX1E(Chip8& c, const Instruction& in) {
+    // I +=Vx	Adds VX to I, wrapping at the end of memory like every access through I.
+    c.I = (c.I + c.V[in.x]) & c.addressMask;
+    c.pc += 2;
+}
+
+void Chip8::opFX29(Chip8& c, const Instruction& in) {
+    // I=sprite_addr[Vx]	Sets I to the location of the sprite for the character in VX.
+    // Characters 0-F (in hexadecimal) are represented by a 4x5 font.
+    c.I = (c.V[in.x] * 0x5);
+    c.pc += 2;
+}
+
+void Chip8::opFX33(Chip8& c, const Instruction& in) {
+    // set_BCD(Vx);
+    //*(I+0)=BCD(3);
+    //
+    //*(I+1)=BCD(2);
+    //
+    //*(I+2)=BCD(1);
+    //
+    // Stores the binary-coded decimal representation of VX, with the most significant of three digits
+    // at the address in I, the middle digit at I plus 1, and the least significant digit at I plus 2.
+    // (In other words, take the decimal representation of VX, place the hundreds digit in memory at
+    // location in I, the tens digit at location I+1, and the ones digit at location I+2.)
+    c.memory[c.I & c.addressMask]       = c.V[in.x] / 100;
+    c.memory[(c.I + 1) & c.addressMask] = (c.V[in.x] / 10) % 10;
+    c.memory[(c.I + 2) & c.addressMask] = (c.V[in.x] % 100) % 10;
+    c.invalidateDecoded(c.I & c.addressMask, 3);
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::opFX55(Chip8& c, const Instruction& in) {
+    // reg_dump(Vx,&I)	Stores V0 to VX (including VX) in memory starting at address I. The offset from
+    // I is increased by 1 for each value written, but I itself is left unmodified, except on the
+    // COSMAC VIP and XO-CHIP, where I ends up past the last value.
+    unsigned int I_it = c.I;
+    for (int it = 0; it <= in.x; ++it) {
+        c.memory[I_it & c.addressMask] = c.V[it];
+        ++I_it;
+    }
+    c.invalidateDecoded(c.I & c.addressMask, in.x + 1);
+    if (QUIRK_SPECS[Q].stepI) {
+        c.I = I_it & c.addressMask;
+    }
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::opFX65(Chip8& c, const Instruction& in) {
+    // reg_load(Vx,&I)	Fills V0 to VX (including VX) with values from memory starting at address I.
+    // The offset from I is increased by 1 for each value written, but I itself is left unmodified,
+    // except on the COSMAC VIP and XO-CHIP, as for FX55
+    unsigned int I_it = c.I;
+    for (int it = 0; it <= in.x; ++it) {
+        c.V[it] = c.memory[I_it & c.addressMask];
+        ++I_it;
+    }
+    if (QUIRK_SPECS[Q].stepI) {
+        c.I = I_it & c.addressMask;
+    }
+    c.pc += 2;
+}
+
+void Chip8::op00CN(Chip8& c, const Instruction& in) {
+    // 0x00CN, scroll the display down by N pixels
+    c.scrollVertical(in.n);
+    c.pc += 2;
+}
+
+void Chip8::op00DN(Chip8& c, const Instruction& in) {
+    // 0x00DN, scroll the display up by N pixels (XO-CHIP)
+    c.scrollVertical(-in.n);
+    c.pc += 2;
+}
+
+void Chip8::op00FB(Chip8& c, const Instruction&) {
+    // 0x00FB, scroll the display right by 4 pixels
+    c.scrollHorizontal(false);
+    c.pc += 2;
+}
+
+void Chip8::op00FC(Chip8& c, const Instruction&) {
+    // 0x00FC, scroll the display left by 4 pixels
+    c.scrollHorizontal(true);
+    c.pc += 2;
+}
+
+void Chip8::op00FD(Chip8& c, const Instruction&) {
+    // 0x00FD, exit the interpreter. pc stays here, so the program goes nowhere.
+    c.exited = true;
+}
+
+void Chip8::op00FE(Chip8& c, const Instruction&) {
+    // 0x00FE, switch to 64x32 lo-res and clear the display
+    c.hires = false;
+    c.clearDisplay();
+    c.pc += 2;
+}
+
+void Chip8::op00FF(Chip8& c, const Instruction&) {
+    // 0x00FF, switch to 128x64 hi-res and clear the display
+    c.hires = true;
+    c.clearDisplay();
+    c.pc += 2;
+}
+
+void Chip8::op5XY2(Chip8& c, const Instruction& in) {
+    // 0x5XY2, store Vx to Vy (in either order) in memory starting at I, I left unmodified (XO-CHIP)
+    int step = in.x <= in.y ? 1 : -1;
+    unsigned int count = (in.x <= in.y ? in.y - in.x : in.x - in.y) + 1;
+    for (unsigned int it = 0; it < count; ++it) {
+        c.memory[(c.I + it) & c.addressMask] = c.V[in.x + step * (int) it];
+    }
+    c.invalidateDecoded(c.I & c.addressMask, count);
+    c.pc += 2;
+}
+
+void Chip8::op5XY3(Chip8& c, const Instruction& in) {
+    // 0x5XY3, load Vx to Vy (in either order) from memory starting at I, I left unmodified (XO-CHIP)
+    int step = in.x <= in.y ? 1 : -1;
+    unsigned int count = (in.x <= in.y ? in.y - in.x : in.x - in.y) + 1;
+    for (unsigned int it = 0; it < count; ++it) {
+        c.V[in.x + step * (int) it] = c.memory[(c.I + it) & c.addressMask];
+    }
+    c.pc += 2;
+}
+
+template <Chip8::Quirks Q>
+void Chip8::opDXYNExtended(Chip8& c, const Instruction& in) {
+    // 0xDXYN on SUPER-CHIP/XO-CHIP: draws in the current resolution, 16x16 when N is 0, into every
+    // selected plane with the sprites for the planes one after the other from I. Sprite lines are
+    // rotated into place as a 128-bit word pair and XORed into their row, wrapping around the edges,
+    // or shifted and cut off at them when clipping.
+    unsigned int width = c.getWidth();
+    unsigned int height = c.getHeight();
+    unsigned int x = c.V[in.x] & (width - 1);
+    unsigned int y = c.V[in.y] & (height - 1);
+    bool wide = in.n == 0;
+    unsigned int lines = wide ? 16 : in.n;
+    unsigned int drawn = QUIRK_SPECS[Q].clip && y + lines > height ? height - y : lines;
+    unsigned int address = c.I;
+    uint64_t collision = 0;
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if ((c.planes & (1u << plane)) == 0) {
+            continue;
         }
-        case 0x8000: // 0x8XY*, several different cases
-        {
-            switch (opcode & 0x000F) {
-                case 0x0000:
-                {
-                    // Assign Vx to the value of Vy
-                    V[(opcode & 0x0FFF) >> 8] = V[(opcode & 0x00FF) >> 4];
-                    pc += 2;
-                    break;
-                }
-                case 0x0001:
-                {
-                    // Sets Vx = Vx|Vy, bitwise OR
-                    V[(opcode & 0x0FFF) >> 8] = (V[(opcode & 0x0FFF) >> 8] | V[(opcode & 0x00FF) >> 4]);
-                    pc += 2;
-                    break;
-                }
-                case 0x0002:
-                {
-                    // Sets Vx = Vx&Vy
-                    V[(opcode & 0x0FFF) >> 8] = (V[(opcode & 0x0FFF) >> 8] & V[(opcode & 0x00FF) >> 4]);
-                    pc += 2;
-                    break;
-                }
-                case 0x0003:
-                {
-                    // Sets Vx = Vx^Vy, Vx to Vx xor Vy
-                    V[(opcode & 0x0FFF) >> 8] = (V[(opcode & 0x0FFF) >> 8] ^ V[(opcode & 0x00FF) >> 4]);
-                    pc += 2;
-                    break;
-                }
-                case 0x0004:
-                {
-                    // Vx += Vy, VF is set to 1 when there's a carry, and to 0 when there isn't.
-                    if (V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00)])) {
-                        V[0xF] = 1; // Set carry flag
-                    } else {
-                        V[0xF] = 0;
-                    }
-                    V[(opcode & 0x0FFF) >> 8] += V[(opcode & 0x00FF) >> 4];
-                    pc += 2;
-                    break;
-                }
-                case 0x0005:
-                {
-                    // Vx -= Vy, VF is set to 0 when there's a borrow, and 1 when there isn't.
-                    if (V[(opcode & 0x00F0) >> 4] > V[(opcode & 0x0F00) >> 8]) {
-                        V[0xF] = 0; // Borrow occurred
-                    } else {
-                        V[0xF] = 1;
-                    }
-                    V[(opcode & 0x0FFF) >> 8] -= V[(opcode & 0x00FF) >> 4];
-                    pc += 2;
-                    break;
-                }
-                case 0x0006:
-                {
-                    // Vx >>=1, Stores the least significant bit of VX in VF and then shifts VX to the right by 1.
-                    V[0xF] = (V[(opcode & 0x0F00) >> 8] & 0x1);
-                    V[(opcode & 0x0F00) >> 8] >>= 1;
-                    pc += 2;
-                    break;
-                }
-                case 0x0007:
-                {
-                    // Vx=Vy-Vx, VF is set to 0 when there's a borrow, and 1 when there isn't.
-                    if (V[(opcode & 0x0F00) >> 8] > V[(opcode & 0x00F0) >> 4]) {
-                        V[0xF] = 0; // Borrow occurred
-                    } else {
-                        V[0xF] = 1;
-                    }
-                    V[(opcode & 0x0FFF) >> 8] = V[(opcode & 0x00FF) >> 4] - V[(opcode & 0x0FFF) >> 8];
-                    pc += 2;
-                    break;
-                }
-                case 0x000E:
-                {
-                    // Vx<<=1, Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
-                    V[0xF] = (V[(opcode & 0x0F00) >> 8] >> 7);
-                    V[(opcode & 0x0F00) >> 8] <<= 1;
-                    pc += 2;
-                    break;
-                }
-                default:
-                    std::cout << "Unknown opcode: 0x" << std::uppercase << std::hex << opcode << "\n" ;
+        for (unsigned int line = 0; line < lines; ++line) {
+            uint64_t left;
+            uint64_t right = 0;
+            if (wide) {
+                left = (uint64_t) (c.memory[address & c.addressMask] << 8 | c.memory[(address + 1) & c.addressMask]) << 48;
+                address += 2;
+            } else {
+                left = (uint64_t) c.memory[address & c.addressMask] << 56;
+                address += 1;
             }
-            break;
-        }
-        case 0x9000: { // 0x9XY0, skips the next instruction if VX doesn't equal VY
-            if (V[(opcode & 0x0FFF) >> 8] != V[(opcode & 0x00FF) >> 4]) {
-                pc += 4;
+            if (line >= drawn) {
+                continue;       // Clipped, but the next plane's sprite starts after it
+            }
+            if (QUIRK_SPECS[Q].clip) {
+                shiftRow(left, right, x, width);
             } else {
-                pc += 2;
+                rotateRow(left, right, x, width);
             }
-            break;
-        }
-        case 0xA000: { // 0xANNN, sets I to the address NNN
-            I = opcode & 0x0FFF;
-            pc += 2;
-            break;
+
+            unsigned int rowIndex = (y + line) & (height - 1);
+            uint64_t* row = c.gfx[plane][rowIndex];
+            collision |= (row[0] & left) | (row[1] & right);
+            row[0] ^= left;
+            row[1] ^= right;
+            c.dirtyRows |= 1ull << rowIndex;
         }
-        case 0xB000: { // 0xBNNN, jump to address NNN plus V0
-            pc = (opcode & 0x0FFF) + V[0];
-            pc += 2;
-            break;
+    }
+
+    c.V[0xF] = collision != 0 ? 1 : 0;
+    c.drawFlag = true;
+    c.gfxBytesStale = true;
+    c.pc += 2;
+}
+
+void Chip8::opF000(Chip8& c, const Instruction& in) {
+    // 0xF000 NNNN, sets I to the 16-bit address NNNN (XO-CHIP)
+    c.I = in.nnn;
+    c.pc += 4;
+}
+
+void Chip8::opF002(Chip8& c, const Instruction&) {
+    // 0xF002, loads the 16-byte audio pattern from I (XO-CHIP)
+    for (unsigned int it = 0; it < 16; ++it) {
+        c.audioPattern[it] = c.memory[(c.I + it) & c.addressMask];
+    }
+    c.pc += 2;
+}
+
+void Chip8::opFN01(Chip8& c, const Instruction& in) {
+    // 0xFN01, selects the bitplanes drawing, scrolling and clearing work on (XO-CHIP)
+    c.planes = in.x & 0x3;
+    c.pc += 2;
+}
+
+void Chip8::opFX30(Chip8& c, const Instruction& in) {
+    // 0xFX30, sets I to the big 8x10 sprite for the digit in VX
+    c.I = SCHIP_FONT_ADDRESS + (c.V[in.x] & 0xF) * 10;
+    c.pc += 2;
+}
+
+void Chip8::opFX3A(Chip8& c, const Instruction& in) {
+    // 0xFX3A, sets the audio pitch to VX (XO-CHIP)
+    c.pitch = c.V[in.x];
+    c.pc += 2;
+}
+
+void Chip8::opFX75(Chip8& c, const Instruction& in) {
+    // 0xFX75, saves V0 to VX in the flag registers
+    for (int it = 0; it <= in.x; ++it) {
+        c.flags[it] = c.V[it];
+    }
+    c.pc += 2;
+}
+
+void Chip8::opFX85(Chip8& c, const Instruction& in) {
+    // 0xFX85, restores V0 to VX from the flag registers
+    for (int it = 0; it <= in.x; ++it) {
+        c.V[it] = c.flags[it];
+    }
+    c.pc += 2;
+}
+
+template <Chip8::Handler first, Chip8::Handler second, Chip8::Fusion fusion>
+void Chip8::opFused(Chip8& c, const Instruction& in) {
+    unsigned short next = c.pc + 2;
+    first(c, in);
+    if (!c.fusing) {
+        return;
+    }
+    ++c.fusionDispatches[fusion];
+
+    // A taken skip left the pair, and a pair straddling the end of the budget runs its second
+    // half in the next dispatch, so cycles and timers line up as if every instruction ran alone
+    if (c.pc == next && c.runCycles + 1 < c.cycleLimit) {
+        const Instruction& following = c.decoded[next & c.addressMask];
+        ++c.fusionHits[fusion];
+        ++c.runCycles;
+        c.opcode = following.opcode;
+        second(c, following);
+    }
+}
+
+template <Chip8::Handler skip>
+void Chip8::opLongSkip(Chip8& c, const Instruction& in) {
+    unsigned short from = c.pc;
+    skip(c, in);
+    if (c.pc == (unsigned short) (from + 4)) {
+        c.pc += 2;
+    }
+}
+
+void Chip8::scrollVertical(int rows) {
+    unsigned int height = getHeight();
+    unsigned int distance = rows < 0 ? -rows : rows;
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if ((planes & (1u << plane)) == 0) {
+            continue;
         }
-        case 0xC000: { // 0xCXNN, Vx=rand()&NN
-            V[(opcode & 0x0FFF) >> 8] = ((std::rand() % 256) & (opcode & 0x00FF));
-            pc += 2;
-            break;
+        // Rows are contiguous, so this is one block move per plane
+        uint64_t (*rowsOf)[ROW_WORDS] = gfx[plane];
+        if (rows > 0) {
+            std::memmove(rowsOf[distance], rowsOf[0], (height - distance) * sizeof(rowsOf[0]));
+            std::memset(rowsOf[0], 0, distance * sizeof(rowsOf[0]));
+        } else {
+            std::memmove(rowsOf[0], rowsOf[distance], (height - distance) * sizeof(rowsOf[0]));
+            std::memset(rowsOf[height - distance], 0, distance * sizeof(rowsOf[0]));
         }
-        case 0xD000: { // 0xDXYN, draw(Vx, Vy, N)
-            unsigned short height;  // Amount of lines, width is 8px
-            unsigned short x;       // Coordinate x
-            unsigned short y;       // Coordinate y
-            unsigned short pixel;
-
-            height = (opcode & 0x000F);
-            x = V[(opcode & 0x0F00) >> 8];
-            y = V[(opcode & 0x00F0) >> 4];
-
-            V[0xF] = 0;
-            for (int yline = 0; yline < height; yline++) {
-                pixel = memory[I + yline];
-                for (int xline = 0; xline < 8; xline++) {
-                    if((pixel & (0x80 >> xline)) != 0) {                    // If pixel to be drawn is 1
-                        if(gfx[(x + xline + ((y + yline) * 64))] == 1) {    // If the pixel on screen is already 1
-                            V[0xF] = 1;
-                        }
-                        gfx[x + xline + ((y + yline) * 64)] ^= 1;           // XOR mode drawing
-                    }
-                }
-            }
+    }
+    touchScreen();
+}
 
-            drawFlag = true;
-            pc += 2;
-            break;
+void Chip8::scrollHorizontal(bool left) {
+    unsigned int height = getHeight();
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if ((planes & (1u << plane)) == 0) {
+            continue;
         }
-        case 0xE000: { // 0xEX9E or 0xEXA1
-            switch (opcode & 0x000F) {
-                case 0x000E: {
-                    // Skips the next instruction if the key stored in VX is pressed.
-                    // (Usually the next instruction is a jump to skip a code block)
-                    if (key[V[(opcode & 0x0FFF) >> 8]] != 0) { // key pressed
-                        pc += 4;
-                    } else {
-                        pc += 2;
-                    }
-                    break;
-                }
-                case 0x0001: {
-                    // Skips the next instruction if the key stored in VX isn't pressed.
-                    // (Usually the next instruction is a jump to skip a code block)
-                    if (key[V[(opcode & 0x0FFF) >> 8]] == 0) { // key not pressed
-                        pc += 4;
-                    } else {
-                        pc += 2;
-                    }
-                    break;
-                }
-                default: {
-                    std::cout << "Unknown opcode: 0x" << std::uppercase << std::hex << opcode << "\n" ;
-                    break;
-                }
+#ifdef __SSE2__
+        // One 128-bit shift per row. The pixels carried between the words of a row cross the
+        // lanes with a byte shift; in lo-res the right word has to stay empty.
+        __m128i keep = _mm_set_epi64x(hires ? -1 : 0, -1);
+        for (unsigned int row = 0; row < height; ++row) {
+            __m128i* p = reinterpret_cast<__m128i*>(gfx[plane][row]);
+            __m128i v = _mm_loadu_si128(p);
+            if (left) {
+                v = _mm_or_si128(_mm_slli_epi64(v, 4), _mm_srli_si128(_mm_srli_epi64(v, 60), 8));
+            } else {
+                v = _mm_or_si128(_mm_srli_epi64(v, 4), _mm_slli_si128(_mm_slli_epi64(v, 60), 8));
             }
-            break;
+            _mm_storeu_si128(p, _mm_and_si128(v, keep));
         }
-        case 0xF000: {
-            int x;
-            x = ((opcode & 0x0F00) >> 8);
-            switch (opcode & 0x00FF) {
-                case 0x0007: {
-                    // Vx = get_delay()	Sets VX to the value of the delay timer.
-                    V[x] = delay_timer;
-                    pc += 2;
-                    break;
-                }
-                case 0x000A: {
-                    // Vx = get_key()	A key press is awaited, and then stored in VX.
-                    // (Blocking Operation. All instruction halted until next key event)
-                    V[x] = getKey();
-                    pc += 2;
-                    break;
-                }
-                case 0x0015: {
-                    // delay_timer(Vx)	Sets the delay timer to VX.
-                    delay_timer = V[x];
-                    pc += 2;
-                    break;
-                }
-                case 0x0018: {
-                    // sound_timer(Vx)	Sets the sound timer to VX.
-                    sound_timer += V[x];
-                    pc += 2;
-                    break;
-                }
-                case 0x001E: {
-                    // I +=Vx	Adds VX to I.
-                    I += V[x];
-                    pc += 2;
-                    break;
-                }
-                case 0x0029: {
-                    // I=sprite_addr[Vx]	Sets I to the location of the sprite for the character in VX.
-                    // Characters 0-F (in hexadecimal) are represented by a 4x5 font.
-                    I = (V[x] * 0x5);
-                    pc += 2;
-                    break;
-                }
-                case 0x0033: {
-                    // set_BCD(Vx);
-                    //*(I+0)=BCD(3);
-                    //
-                    //*(I+1)=BCD(2);
-                    //
-                    //*(I+2)=BCD(1);
-                    //
-                    // Stores the binary-coded decimal representation of VX, with the most significant of three digits
-                    // at the address in I, the middle digit at I plus 1, and the least significant digit at I plus 2.
-                    // (In other words, take the decimal representation of VX, place the hundreds digit in memory at
-                    // location in I, the tens digit at location I+1, and the ones digit at location I+2.)
-                    memory[I]     = V[(opcode & 0x0F00) >> 8] / 100;
-                    memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-                    memory[I + 2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
-                    pc += 2;
-                    break;
-                }
-                case 0x0055: {
-                    // reg_dump(Vx,&I)	Stores V0 to VX (including VX) in memory starting at address I. The offset from
-                    // I is increased by 1 for each value written, but I itself is left unmodified.
-                    unsigned int I_it = I;
-                    for (int it = 0; it <= x; ++it) {
-                        memory[I_it] = V[it];
-                        ++I_it;
-                    }
-                    pc += 2;
-                    break;
-                }
-                case 0x0065: {
-                    // reg_load(Vx,&I)	Fills V0 to VX (including VX) with values from memory starting at address I.
-                    // The offset from I is increased by 1 for each value written, but I itself is left unmodified
-                    unsigned int I_it = I;
-                    for (int it = 0; it <= x; ++it) {
-                        V[it] = memory[I_it];
-                        ++I_it;
-                    }
-                    pc += 2;
-                    break;
-                }
+#else
+        for (unsigned int row = 0; row < height; ++row) {
+            uint64_t* words = gfx[plane][row];
+            if (left) {
+                words[0] = (words[0] << 4) | (words[1] >> 60);
+                words[1] <<= 4;
+            } else {
+                words[1] = hires ? (words[1] >> 4) | (words[0] << 60) : 0;
+                words[0] >>= 4;
             }
-            break;
         }
-        default: {
-            std::cout << "Unknown opcode: 0x" << std::uppercase << std::hex << opcode << "\n" ;
+#endif
+    }
+    touchScreen();
+}
+
+void Chip8::stop(Fault fault) {
+    this->fault = fault;
+    cycleLimit = 0;
+}
+
+void Chip8::touchScreen() {
+    drawFlag = true;
+    dirtyRows = ~0ull;
+    gfxBytesStale = true;
+}
+
+size_t Chip8::getStateSize() const {
+    const PlatformSpec& spec = PLATFORMS[platform];
+    return STATE_FIXED_SIZE + spec.memorySize + spec.planes * spec.rows * spec.rowWords * 8;
+}
+
+void Chip8::saveState(std::vector<unsigned char>& out) {
+    const PlatformSpec& spec = PLATFORMS[platform];
+    out.resize(getStateSize());
+    StateWriter w(out.data());
+
+    w.bytes(reinterpret_cast<const unsigned char*>(STATE_MAGIC), 4);
+    w.u16(STATE_VERSION);
+    w.u16(0);
+
+    w.u8(platform);
+    w.u8(hires ? 1 : 0);
+    w.u8(planes);
+    w.u8(exited ? 1 : 0);
+    w.bytes(memory.data(), spec.memorySize);
+    w.bytes(V, 16);
+    // pc runs past the end of memory on the smaller platforms, where every fetch wraps
+    w.u16(I);
+    w.u16(pc & addressMask);
+    for (int i = 0; i < 16; ++i) {
+        w.u16(stack[i] & addressMask);
+    }
+    w.u16(sp);
+    w.u8(delay_timer);
+    w.u8(sound_timer);
+    for (unsigned int plane = 0; plane < spec.planes; ++plane) {
+        for (unsigned int row = 0; row < spec.rows; ++row) {
+            for (unsigned int word = 0; word < spec.rowWords; ++word) {
+                w.u64(gfx[plane][row][word]);
+            }
         }
     }
+    w.bytes(flags, 16);
+    w.bytes(audioPattern, 16);
+    w.u8(pitch);
+    for (int i = 0; i < 16; ++i) {
+        w.u8((keys >> i) & 1);
+    }
+    w.u16(opcode);
+    w.u32(rng);
+}
 
-    std::cout << "\nCurrent opcode: 0x" << std::uppercase << std::hex << opcode << "\n" ;
+bool Chip8::loadState(const unsigned char* data, size_t size) {
+    const PlatformSpec& spec = PLATFORMS[platform];
+    if (size != getStateSize() || std::memcmp(data, STATE_MAGIC, 4) != 0) {
+        return false;
+    }
+    StateReader r(data + 4);
+    if (r.u16() != STATE_VERSION) {
+        return false;
+    }
+    r.u16();
+    if (r.u8() != platform || !validState(data)) {
+        return false;
+    }
+    hires = r.u8() != 0;
+    planes = r.u8();
+    exited = r.u8() != 0;
 
-    // Update timers
-    if (delay_timer > 0) {
-        --delay_timer;
+    // Only drop the decodes of memory that actually differs
+    const unsigned char* newMemory = data + STATE_HEADER_SIZE + 4;
+    for (unsigned int i = 0; i < spec.memorySize; ++i) {
+        if (memory[i] != newMemory[i]) {
+            invalidateDecoded(i, 1);
+        }
     }
+    r.bytes(memory.data(), spec.memorySize);
 
-    if (sound_timer > 0) {
-        if (sound_timer == 1) {
-            std::cout << "Beep!\n";
-            --sound_timer;
+    r.bytes(V, 16);
+    I = r.u16();
+    pc = r.u16();
+    for (int i = 0; i < 16; ++i) {
+        stack[i] = r.u16();
+    }
+    sp = r.u16();
+    delay_timer = r.u8();
+    sound_timer = r.u8();
+    for (unsigned int plane = 0; plane < spec.planes; ++plane) {
+        for (unsigned int row = 0; row < spec.rows; ++row) {
+            for (unsigned int word = 0; word < spec.rowWords; ++word) {
+                gfx[plane][row][word] = r.u64();
+            }
         }
     }
+    r.bytes(flags, 16);
+    r.bytes(audioPattern, 16);
+    pitch = r.u8();
+    keys = 0;
+    for (int i = 0; i < 16; ++i) {
+        keys |= (r.u8() != 0 ? 1 : 0) << i;
+    }
+    opcode = r.u16();
+    rng = r.u32();
 
+    // Not saved: a wait implies no key is down, so the Fx0A at pc simply waits again, and a
+    // faulting instruction faults again
+    waitingForKey = false;
+    fault = FAULT_NONE;
+    loopPassed = false;
+    loopSnapshot = false;
+
+    // Whatever is on the host screen is stale now
+    touchScreen();
+    return true;
+}
+
+bool Chip8::validState(const unsigned char* data) const {
+    const PlatformSpec& spec = PLATFORMS[platform];
+    StateReader r(data + STATE_HEADER_SIZE + 1);
+    unsigned char savedHires = r.u8();
+    unsigned char savedPlanes = r.u8();
+    unsigned char savedExited = r.u8();
+    if (savedHires > (spec.rowWords > 1 ? 1 : 0) || (savedPlanes >> spec.planes) != 0 || savedExited > 1) {
+        return false;
+    }
 
+    // Addresses beyond the platform's memory and a stack pointer past the stack would index out
+    // of bounds
+    r = StateReader(data + STATE_HEADER_SIZE + 4 + spec.memorySize + 16);
+    if (r.u16() > addressMask || r.u16() > addressMask) {
+        return false;
+    }
+    for (int i = 0; i < 16; ++i) {
+        if (r.u16() > addressMask) {
+            return false;
+        }
+    }
+    return r.u16() <= 16;
 }
 
 bool Chip8::loadProgram(std::string name) {
+    // Read, validated and shared through the process-wide ROM cache
+    std::shared_ptr<const RomImage> rom = RomCache::instance().load(name);
+    if (rom == nullptr) {
+        return false;
+    }
+    return loadProgram(*rom);
+}
+
+bool Chip8::loadProgram(const RomImage& rom) {
     // Start filling the memory from 0x200 = 512
-    int memoryIndex = 512;
-    const char * c_name;
-    c_name = name.c_str();
+    if (rom.size() > PLATFORMS[platform].memorySize - 512) {
+        return false;
+    }
+    std::memcpy(memory.data() + 512, rom.data(), rom.size());
+    invalidateDecoded(512, rom.size());
+    return true;
+}
 
-    // Open the file in binary mode, with fopen
-    FILE * programFile;
-    programFile = fopen(c_name, "rb");
+const char* Chip8::platformName(Platform platform) {
+    return PLATFORMS[platform].name;
+}
 
-    // Read the program to the memory
-    if (programFile == nullptr) {
-        return false;
-    } else {
-        int c;
-        while ((c = fgetc(programFile)) != EOF) {
-            memory[memoryIndex] = c;
-            ++memoryIndex;
-            std::cout << "\nOpcode: " << std::uppercase << std::hex << c ;
+bool Chip8::parsePlatform(const std::string& name, Platform& platform) {
+    for (int i = 0; i < PLATFORM_COUNT; ++i) {
+        if (name == PLATFORMS[i].name) {
+            platform = static_cast<Platform>(i);
+            return true;
         }
     }
-    return true;
+    return false;
 }
 
-unsigned char Chip8::getKey() {
-    while (true) {
-        for (unsigned short i = 0; i < 16; ++i) {
-            if (key[i] != 0) {
-                return i;
-            }
+Chip8::Quirks Chip8::defaultQuirks(Platform platform) {
+    return PLATFORMS[platform].quirks;
+}
+
+const char* Chip8::quirksName(Quirks quirks) {
+    return QUIRKS_NAMES[quirks];
+}
+
+bool Chip8::parseQuirks(const std::string& name, Quirks& quirks) {
+    for (int i = 0; i < QUIRKS_COUNT; ++i) {
+        if (name == QUIRKS_NAMES[i]) {
+            quirks = static_cast<Quirks>(i);
+            return true;
         }
     }
+    return false;
 }
 
 void Chip8::clearDisplay() {
-    for (int i = 0; i < 2048; ++i) {
-        gfx[i] = 0x0;
+    clearPlanes((1u << PLANE_COUNT) - 1);
+}
+
+void Chip8::clearPlanes(unsigned int mask) {
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+        if ((mask & (1u << plane)) != 0) {
+            std::memset(gfx[plane], 0, sizeof(gfx[plane]));
+        }
     }
-    drawFlag = true;
+    touchScreen();
 }
 
 void Chip8::clearStack() {
@@ -423,80 +1466,96 @@ void Chip8::clearRegisters() {
 }
 
 void Chip8::clearMemory() {
-    for (int i = 0; i < 4096; ++i) {
-        memory[i] = 0x0;
-    }
+    std::memset(memory.data(), 0, PLATFORMS[platform].memorySize);
+    invalidateDecoded(0, PLATFORMS[platform].memorySize);
 }
 
 void Chip8::loadFontset() {
     for (int i = 0; i < 80; ++i) {
         memory[i] = chip8_fontset[i];
     }
+    invalidateDecoded(0, 80);
+
+    if (platform != PLATFORM_CHIP8) {
+        std::memcpy(memory.data() + SCHIP_FONT_ADDRESS, schip_fontset, sizeof(schip_fontset));
+        invalidateDecoded(SCHIP_FONT_ADDRESS, sizeof(schip_fontset));
+    }
+}
+
+void Chip8::setKeyInput(KeyInput* input) {
+    keyInput = input;
+}
+
+void Chip8::setTrace(TraceRing* ring) {
+    traceRing = ring;
+}
+
+void Chip8::setAudio(ToneRing* ring) {
+    toneRing = ring;
+    // Republish the tone on the next tick, the new ring starts silent
+    toneOn = false;
+}
+
+void Chip8::setProfiler(Profiler* profiler) {
+    this->profiler = profiler;
 }
 
 void Chip8::setKeys() {
-    clearKeys();
-    const Uint8* currentKeyStates = SDL_GetKeyboardState(nullptr);
-    if(currentKeyStates[SDL_SCANCODE_1]) {
-        key[0] = 1;
-    }
-    if (currentKeyStates[SDL_SCANCODE_2]) {
-        key[1] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_3]) {
-        key[2] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_4]) {
-        key[3] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_Q]) {
-        key[4] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_W]) {
-        key[5] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_E]) {
-        key[6] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_R]) {
-        key[7] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_A]) {
-        key[8] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_S]) {
-        key[9] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_D]) {
-        key[10] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_F]) {
-        key[11] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_Z]) {
-        key[12] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_X]) {
-        key[13] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_C]) {
-        key[14] = 1;
-    }
-    if(currentKeyStates[SDL_SCANCODE_V]) {
-        key[15] = 1;
+    keys = keyInput != nullptr ? keyInput->readKeys() : 0;
+    loopSnapshot = false;
+
+    if (waitingForKey && keys != 0) {
+        // The next cycle runs the Fx0A again and takes the key
+        waitingForKey = false;
+#ifdef CHIP8_PROFILE
+        if (profiler != nullptr) {
+            auto waited = std::chrono::steady_clock::now() - keyWaitStart;
+            profiler->onKeyWait(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+        }
+#endif
     }
 }
 
 void Chip8::clearKeys() {
-    for (int i = 0; i < 16; ++i) {
-        key[i] = 0;
-    }
+    keys = 0;
 }
 
 bool Chip8::getDrawFlag() {
     return drawFlag;
 }
 
+uint64_t Chip8::getDirtyRows() {
+    return dirtyRows;
+}
+
+void Chip8::clearDrawFlag() {
+    drawFlag = false;
+    dirtyRows = 0;
+}
+
+unsigned int Chip8::getPlaneCount() const {
+    return PLATFORMS[platform].planes;
+}
+
 const unsigned char *Chip8::getGraphics() {
-    return gfx;
+    if (gfxBytesStale) {
+        unsigned int width = getWidth();
+        unsigned int height = getHeight();
+        gfxBytes.resize(width * height);
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int x = 0; x < width; ++x) {
+                unsigned char pixel = 0;
+                for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane) {
+                    pixel |= ((gfx[plane][y][x / 64] >> (63 - x % 64)) & 0x1) << plane;
+                }
+                gfxBytes[x + y * width] = pixel;
+            }
+        }
+        gfxBytesStale = false;
+    }
+    return gfxBytes.data();
+}
+
+const uint64_t *Chip8::getFramebuffer(unsigned int plane) const {
+    return gfx[plane][0];
 }
@@ -1,27 +1,148 @@
 #ifndef CHIP8_CHIP8_H
 #define CHIP8_CHIP8_H
 
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "key_input.h"
+
+class Profiler;
+class RomImage;
+class ToneRing;
+class TraceRing;
 
 class Chip8 {
+    friend class Chip8Jit;
+    friend class Chip8Threaded;
+
 public:
+    // Machine the core emulates. SUPER-CHIP adds the 128x64 hi-res mode, scrolling, 16x16
+    // sprites, a big font and flag registers; XO-CHIP adds 64K of memory, a second bitplane,
+    // 00DN, 5XY2/5XY3, F000 NNNN and the audio pattern registers on top.
+    enum Platform {
+        PLATFORM_CHIP8,
+        PLATFORM_SUPERCHIP,
+        PLATFORM_XOCHIP,
+        PLATFORM_COUNT
+    };
+
+    // Behaviors the CHIP-8 variants disagree on, bundled per variant. Each profile runs its own
+    // instantiation of the handlers concerned, chosen when an instruction is decoded, so the
+    // quirks cost no tests while running. Every platform has a default one (see initialize()).
+    enum Quirks {
+        QUIRKS_COSMAC,          // COSMAC VIP: 8XY1-3 reset VF, 8XY6/E shift Vy, FX55/65 step I, sprites clip
+        QUIRKS_MODERN,          // Most CHIP-8 interpreters since: shift Vx, leave I, sprites wrap
+        QUIRKS_SCHIP,           // SUPER-CHIP 1.1: as modern, but BXNN jumps to XNN + Vx and sprites clip
+        QUIRKS_XOCHIP,          // Octo: shift Vy, FX55/65 step I, sprites wrap
+        QUIRKS_COUNT
+    };
+
+    // Superinstructions: common pairs of instructions the decode cache runs in one dispatch
+    enum Fusion {
+        FUSION_6XNN_6XNN,       // Register loads in a row
+        FUSION_ANNN_DXYN,       // Point I at a sprite and draw it
+        FUSION_3XNN_1NNN,       // Conditional jumps
+        FUSION_4XNN_1NNN,
+        FUSION_7XNN_FX1E,       // Step a counter and the index together
+        FUSION_FX1E_DXYN,       // Step the index and draw, in sprite loops
+        FUSION_6XNN_00EE,       // Leaf subroutine tails
+        FUSION_7XNN_00EE,
+        FUSION_DXYN_00EE,
+        FUSION_COUNT
+    };
+
+    // Errors in the program that stop the CPU. The faulting instruction stays at pc.
+    enum Fault {
+        FAULT_NONE,
+        FAULT_STACK_OVERFLOW,   // 2NNN with all 16 stack entries in use
+        FAULT_STACK_UNDERFLOW,  // 00EE with an empty stack
+        FAULT_UNKNOWN_OPCODE,   // An opcode the platform doesn't decode
+        FAULT_COUNT
+    };
+
+    // Screen geometry. Each bitplane is stored as MAX_HEIGHT rows of ROW_WORDS words, the
+    // leftmost pixel of a row in the most significant bit of its first word.
+    static const unsigned int MAX_WIDTH = 128;
+    static const unsigned int MAX_HEIGHT = 64;
+    static const unsigned int PLANE_COUNT = 2;
+    static const unsigned int ROW_WORDS = 2;
+
     // Constructor.
     Chip8() = default;
 
-    // Initializer.
-    void initialize();
+    // Initializer. seed selects the CXNN random sequence, the same seed replays the same run.
+    // Runs with the quirks of the platform: QUIRKS_MODERN on CHIP-8, QUIRKS_SCHIP on SUPER-CHIP
+    // and QUIRKS_XOCHIP on XO-CHIP.
+    void initialize(uint32_t seed = 0, Platform platform = PLATFORM_CHIP8);
+
+    // Initializer for a program written for other quirks than its platform's
+    void initialize(uint32_t seed, Platform platform, Quirks quirks);
 
     // Emulates one cpu cycle.
     void emulateCycle();
 
+    // Emulates up to budget cycles, fewer if an Fx0A halts the CPU or a fault stops it. Returns the
+    // number of cycles emulated, counting the idle loop iterations skipped (see skipIdleLoop()).
+    unsigned int run(unsigned int budget);
+
+    // For engines stepping the CPU themselves, to call after every step. If the step closed an
+    // iteration of a loop that left the machine exactly as it found it (say F007 / 3000 / 1NNN
+    // waiting for the delay timer), every further iteration until the timers tick or the keys
+    // change does the same, so returns executed advanced over as many as fit in budget.
+    // Returns executed unchanged otherwise.
+    unsigned int skipIdleLoop(unsigned int executed, unsigned int budget);
+
+    // Turns idle loop skipping on (the default) or off. It never skips while tracing or profiling.
+    void setIdleLoopSkipping(bool enabled);
+
+    // Returns the number of cycles skipped in idle loops since initialize()
+    uint64_t getIdleSkippedCount() const;
+
+    // Turns superinstruction fusion on (the default) or off. Only run() fuses, and never while
+    // tracing or profiling; emulateCycle() always runs a single instruction.
+    void setFusion(bool enabled);
+
+    // Returns the printable name of fusion, e.g. "ANNN+DXYN"
+    static const char* fusionName(Fusion fusion);
+
+    // Returns how often the first instruction of fusion was dispatched by run() since initialize(),
+    // and how often the second instruction ran in the same dispatch
+    uint64_t getFusionDispatchCount(Fusion fusion) const;
+    uint64_t getFusionHitCount(Fusion fusion) const;
+
+    // Counts the delay and sound timers down by one and publishes a change of the tone to the
+    // audio ring. Call at 60 Hz.
+    void tickTimers();
+
     // Load the program to memory. Returns false if load failed.
     bool loadProgram(std::string name);
 
-    // Waits until a key is pressed and then returns the pressed key.
-    // Blocks all other operations until received a key press
-    unsigned char getKey();
+    // Load an already validated program image to memory. Returns false if it doesn't fit the platform's memory.
+    bool loadProgram(const RomImage& rom);
+
+    // Returns the platform chosen by initialize()
+    Platform getPlatform() const { return platform; }
 
-    // Clears display, sets all gfx[] to zero
+    // Returns the command line name of platform ("chip8", "schip", "xochip")
+    static const char* platformName(Platform platform);
+
+    // Looks up a platform by its name. Returns false if there is none.
+    static bool parsePlatform(const std::string& name, Platform& platform);
+
+    // Returns the quirks profile chosen by initialize()
+    Quirks getQuirks() const { return quirks; }
+
+    // Returns the quirks profile a platform runs with unless told otherwise
+    static Quirks defaultQuirks(Platform platform);
+
+    // Returns the command line name of quirks ("cosmac", "modern", "schip", "xochip")
+    static const char* quirksName(Quirks quirks);
+
+    // Looks up a quirks profile by its name. Returns false if there is none.
+    static bool parseQuirks(const std::string& name, Quirks& quirks);
+
+    // Clears display, all bitplanes
     void clearDisplay();
 
     // Clears stack
@@ -36,51 +157,316 @@ public:
     // Loads the fontset to memory
     void loadFontset();
 
-    // Set currently pressed keys
+    // Set the source polled by setKeys(). Nullptr leaves all keys released.
+    void setKeyInput(KeyInput* input);
+
+    // Set the ring executed instructions are recorded into. Nullptr turns tracing off.
+    // Has no effect unless the core is built with CHIP8_TRACE.
+    void setTrace(TraceRing* ring);
+
+    // Set the ring tone changes are published to. Nullptr turns audio off.
+    void setAudio(ToneRing* ring);
+
+    // Set the profiler executed instructions are counted in. Nullptr turns profiling off.
+    // Has no effect unless the core is built with CHIP8_PROFILE.
+    void setProfiler(Profiler* profiler);
+
+    // Takes the snapshot of the pressed keys for the next frame from the key input.
+    // Pressing any key ends an Fx0A wait.
     void setKeys();
 
-    // Clear the pressed keys array
+    // Returns true while an Fx0A waits for a key. emulateCycle() does nothing until setKeys()
+    // sees a key pressed, so the host can sleep until a key event arrives.
+    bool isWaitingForKey() const { return waitingForKey; }
+
+    // Returns true while halted in Fx0A, by 00FD or on a fault with both timers stopped and the
+    // tone published as off. Frames change nothing then, so the host may block on input instead
+    // of running them.
+    bool isIdle() const {
+        return (waitingForKey || exited || fault != FAULT_NONE) && delay_timer == 0 && sound_timer == 0 && !toneOn;
+    }
+
+    // Returns true once a SUPER-CHIP 00FD has stopped the program. It stays on the 00FD.
+    bool isExited() const { return exited; }
+
+    // Returns the fault that stopped the program, FAULT_NONE while it runs. Running on retries the
+    // faulting instruction, which faults again.
+    Fault getFault() const { return fault; }
+
+    // Returns the printable name of fault, e.g. "stack overflow"
+    static const char* faultName(Fault fault);
+
+    // Releases all keys
     void clearKeys();
 
     // Returns the draw flag
     bool getDrawFlag();
 
-    // Returns the screen pointer
+    // Returns the rows changed since the draw flag was last cleared, bit n for row n
+    uint64_t getDirtyRows();
+
+    // Clears the draw flag and the dirty rows, once the screen has been presented
+    void clearDrawFlag();
+
+    // Returns the screen size in pixels: 64x32, or 128x64 in SUPER-CHIP/XO-CHIP hi-res mode
+    unsigned int getWidth() const { return hires ? 128 : 64; }
+    unsigned int getHeight() const { return hires ? 64 : 32; }
+
+    // Returns the number of bitplanes the platform has, 2 on XO-CHIP
+    unsigned int getPlaneCount() const;
+
+    // Returns the screen as getWidth() * getHeight() bytes, one per pixel with bit n set where
+    // plane n is. Expanded from the packed rows on demand.
     const unsigned char* getGraphics();
 
+    // Returns bitplane plane (see MAX_HEIGHT). Only the top getHeight() rows and the left
+    // getWidth() pixels are in use, so a lo-res screen is the first word of the first 32 rows.
+    const uint64_t* getFramebuffer(unsigned int plane = 0) const;
+
+    // Hex digit sprites loaded at address 0, 5 bytes per character
+    static const unsigned char chip8_fontset[80];
+
+    // SUPER-CHIP/XO-CHIP 8x10 hex digit sprites loaded after them, 10 bytes per character
+    static const unsigned char schip_fontset[160];
+
+    // Returns the size in bytes of a saved state, which depends on the platform
+    size_t getStateSize() const;
+
+    // Serializes the complete machine state into a versioned blob of getStateSize() bytes
+    void saveState(std::vector<unsigned char>& out);
+
+    // Restores a blob produced by saveState(). Returns false, leaving the machine untouched,
+    // if the blob is malformed, from another state version or from another platform, or holds
+    // registers the platform can't have (see validState()).
+    bool loadState(const unsigned char* data, size_t size);
+
 private:
+    struct Instruction;
+
+    // Executes one predecoded instruction
+    typedef void (*Handler)(Chip8&, const Instruction&);
+
+    // Predecoded instruction, cached per memory address
+    struct Instruction {
+        Handler handler;            // Nullptr until the address is decoded
+        unsigned short opcode;      // Raw opcode
+        unsigned short nnn;         // Address operand, opcode & 0x0FFF, or the word after F000
+        unsigned char x;            // Register operand, (opcode & 0x0F00) >> 8
+        unsigned char y;            // Register operand, (opcode & 0x00F0) >> 4
+        unsigned char n;            // Nibble operand, opcode & 0x000F
+        unsigned char nn;           // Byte operand, opcode & 0x00FF
+    };
+
+    // What a Quirks profile chooses. Handlers take the profile as a template argument and test
+    // these as constants; engines generating their own code read them at translation time.
+    struct QuirkSpec {
+        bool vfReset;               // 8XY1/8XY2/8XY3 set VF to 0
+        bool shiftVy;               // 8XY6/8XYE shift Vy into Vx, instead of Vx in place
+        bool stepI;                 // FX55/FX65 leave I past the last register, instead of unchanged
+        bool jumpVx;                // BXNN jumps to XNN + Vx, instead of NNN + V0
+        bool clip;                  // DXYN cuts sprites off at the screen edges, instead of wrapping
+    };
+    static constexpr QuirkSpec QUIRK_SPECS[QUIRKS_COUNT] = {
+            { true,  true,  true,  false, true  },
+            { false, false, false, false, false },
+            { false, false, false, true,  true  },
+            { false, true,  true,  false, false },
+    };
+
+    // The instantiations of the quirk dependent handlers for one profile, and its superinstructions
+    struct QuirkHandlers {
+        Handler op8XY1;
+        Handler op8XY2;
+        Handler op8XY3;
+        Handler op8XY6;
+        Handler op8XYE;
+        Handler opBNNN;
+        Handler opDXYN;
+        Handler opDXYNExtended;
+        Handler opFX55;
+        Handler opFX65;
+        Handler (*fused)(Handler first, Handler second);
+    };
+    static const QuirkHandlers QUIRK_HANDLERS[QUIRKS_COUNT];
+
+    // Returns the handlers of profile Q
+    template <Quirks Q>
+    static QuirkHandlers quirkHandlers();
+
+    // Executes instruction and records it into traceRing and/or profiler
+    void instrumentedCycle(const Instruction& instruction);
+
+    // Decodes the opcode at address into instruction. With fuse, an instruction starting a
+    // superinstruction gets the fused handler, and the instruction after it is decoded into
+    // the cache for its operands.
+    void decode(unsigned short address, Instruction& instruction, bool fuse = true);
+
+    // Returns the superinstruction handler of first followed by second under the quirks Q,
+    // nullptr if they don't fuse
+    template <Quirks Q>
+    static Handler fusedHandler(Handler first, Handler second);
+
+    // Drops the cached decodes overlapping a write of length bytes at address
+    void invalidateDecoded(unsigned int address, unsigned int length);
+
+    // Returns true if the instructions in [first, last) only read memory, the timers and the keys,
+    // and only change V and I
+    bool isSideEffectFree(unsigned short first, unsigned short last);
+
+    // Runs the side-effect-free loop body from pc, the loop head, to the closing jump at loopEnd
+    // and puts pc, V and I back. Returns the cycles of the pass, jump included, if it went
+    // straight through the body and changed nothing, 0 if it left the body or changed V or I.
+    unsigned int idlePassLength();
+
+    // Clears the bitplanes set in mask
+    void clearPlanes(unsigned int mask);
+
+    // Moves the selected planes rows down, negative rows up, blanking the rows scrolled in
+    void scrollVertical(int rows);
+
+    // Moves the selected planes 4 pixels left or right, blanking the columns scrolled in
+    void scrollHorizontal(bool left);
+
+    // Marks the whole screen for redrawing
+    void touchScreen();
+
+    // Stops the CPU on fault, leaving pc on the faulting instruction and ending run()
+    void stop(Fault fault);
+
+    // Returns true if the flags, addresses and stack pointer in a state blob of the right size,
+    // version and platform fit this platform, before loadState() commits any of it
+    bool validState(const unsigned char* data) const;
+
+    // Opcode handlers. Those templated on Q behave as the quirks profile Q says.
+    static void opUnknown(Chip8& c, const Instruction& in);
+    static void op00E0(Chip8& c, const Instruction& in);
+    static void op00EE(Chip8& c, const Instruction& in);
+    static void op1NNN(Chip8& c, const Instruction& in);
+    static void op1NNNLoop(Chip8& c, const Instruction& in);
+    static void op2NNN(Chip8& c, const Instruction& in);
+    static void op3XNN(Chip8& c, const Instruction& in);
+    static void op4XNN(Chip8& c, const Instruction& in);
+    static void op5XY0(Chip8& c, const Instruction& in);
+    static void op6XNN(Chip8& c, const Instruction& in);
+    static void op7XNN(Chip8& c, const Instruction& in);
+    static void op8XY0(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void op8XY1(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void op8XY2(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void op8XY3(Chip8& c, const Instruction& in);
+    static void op8XY4(Chip8& c, const Instruction& in);
+    static void op8XY5(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void op8XY6(Chip8& c, const Instruction& in);
+    static void op8XY7(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void op8XYE(Chip8& c, const Instruction& in);
+    static void op9XY0(Chip8& c, const Instruction& in);
+    static void opANNN(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void opBNNN(Chip8& c, const Instruction& in);
+    static void opCXNN(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void opDXYN(Chip8& c, const Instruction& in);
+    static void opEX9E(Chip8& c, const Instruction& in);
+    static void opEXA1(Chip8& c, const Instruction& in);
+    static void opFX07(Chip8& c, const Instruction& in);
+    static void opFX0A(Chip8& c, const Instruction& in);
+    static void opFX15(Chip8& c, const Instruction& in);
+    static void opFX18(Chip8& c, const Instruction& in);
+    static void opFX1E(Chip8& c, const Instruction& in);
+    static void opFX29(Chip8& c, const Instruction& in);
+    static void opFX33(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void opFX55(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void opFX65(Chip8& c, const Instruction& in);
+
+    // SUPER-CHIP and XO-CHIP handlers
+    static void op00CN(Chip8& c, const Instruction& in);
+    static void op00DN(Chip8& c, const Instruction& in);
+    static void op00FB(Chip8& c, const Instruction& in);
+    static void op00FC(Chip8& c, const Instruction& in);
+    static void op00FD(Chip8& c, const Instruction& in);
+    static void op00FE(Chip8& c, const Instruction& in);
+    static void op00FF(Chip8& c, const Instruction& in);
+    static void op5XY2(Chip8& c, const Instruction& in);
+    static void op5XY3(Chip8& c, const Instruction& in);
+    template <Quirks Q>
+    static void opDXYNExtended(Chip8& c, const Instruction& in);
+    static void opF000(Chip8& c, const Instruction& in);
+    static void opF002(Chip8& c, const Instruction& in);
+    static void opFN01(Chip8& c, const Instruction& in);
+    static void opFX30(Chip8& c, const Instruction& in);
+    static void opFX3A(Chip8& c, const Instruction& in);
+    static void opFX75(Chip8& c, const Instruction& in);
+    static void opFX85(Chip8& c, const Instruction& in);
+
+    // XO-CHIP skip that steps over a following 4-byte F000 NNNN, wrapping the 2-byte one
+    template <Handler skip>
+    static void opLongSkip(Chip8& c, const Instruction& in);
+
+    // Superinstruction: runs first, then second on the next instruction if first went on to it
+    // and run()'s budget has room for it
+    template <Handler first, Handler second, Fusion fusion>
+    static void opFused(Chip8& c, const Instruction& in);
+
+    Platform platform = PLATFORM_CHIP8;     // Machine being emulated
+    unsigned int addressMask = 0x0FFF;      // Memory size of the platform - 1
+    Quirks quirks = QUIRKS_MODERN;          // Behavior the handlers are decoded for
     unsigned short opcode;          // For storing the current opcode.
-    unsigned char memory[4096];     // Emulated total memory of 4K bytes.
+    std::vector<unsigned char> memory;  // Emulated memory, 4K except on XO-CHIP, sized by initialize()
     unsigned char V[16];            // Emulated CPU registers.
-    unsigned short I;               // Index register.
+    unsigned short I;               // Index register, within addressMask
     unsigned short pc;              // Program counter.
-    unsigned char gfx[64 * 32];     // Black and white graphics screen pixels.
+    uint64_t gfx[PLANE_COUNT][MAX_HEIGHT][ROW_WORDS];   // Graphics screen bitplanes, one bit per pixel.
+    bool hires;                     // SUPER-CHIP 128x64 mode
+    unsigned char planes;           // Bitplanes drawn, scrolled and cleared, bit n for plane n (XO-CHIP FN01)
+    bool exited;                    // Stopped by 00FD
+    Fault fault = FAULT_NONE;       // Stopped by an error in the program, see stop()
+    unsigned char flags[16];        // SUPER-CHIP/XO-CHIP flag registers (FX75/FX85)
+    unsigned char audioPattern[16]; // XO-CHIP 1-bit audio pattern (F002)
+    unsigned char pitch;            // XO-CHIP audio pitch (FX3A)
     unsigned char delay_timer;      // Delay timer. Count at 60hz, or zero, if set above zero.
-    unsigned char sound_timer;      // Sound timer. System buzzer sounds when the timer reaches zero.
+    unsigned char sound_timer;      // Sound timer. The tone plays while it is above zero.
     unsigned short stack[16];       // Jump call stack.
     unsigned short sp;              // Stack pointer.
-    unsigned char key[16];          // Current state of the hex keypad. 1 = pressed, 0 = released
+    uint32_t rng;                   // CXNN random generator state, see xorshift.h
+    uint16_t keys;                  // Current state of the hex keypad, bit n set while key n is pressed
+    bool waitingForKey = false;     // Halted in Fx0A until a key is pressed, implies keys == 0
+    std::chrono::steady_clock::time_point keyWaitStart;     // When the current Fx0A wait began, for the profiler
     bool drawFlag;                  // If set true, need to redraw the screen
-
-    unsigned char chip8_fontset[80] =
-            {
-                    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-                    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-                    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-                    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-                    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-                    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-                    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-                    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-                    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-                    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-                    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-                    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-                    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-                    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-                    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-                    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-            };
+    uint64_t dirtyRows;             // Rows changed since the last redraw, bit n for row n
+    KeyInput* keyInput = nullptr;   // Injected keypad source, not owned
+    TraceRing* traceRing = nullptr; // Trace destination, not owned
+    ToneRing* toneRing = nullptr;   // Audio destination, not owned
+    uint64_t timerTicks = 0;        // tickTimers() calls, the clock of the tone events
+    bool toneOn = false;            // Tone last published to toneRing
+    unsigned char tonePitch = 0;
+    unsigned char tonePattern[16] = {};
+    Profiler* profiler = nullptr;   // Profile destination, not owned
+    std::vector<unsigned char> gfxBytes;    // Byte per pixel view of gfx for getGraphics()
+    bool gfxBytesStale = true;              // Set when gfx changed since gfxBytes was built
+    std::vector<Instruction> decoded;   // Decode cache indexed by pc, one entry per memory byte, sized with memory
+    unsigned int codeGeneration = 0;// Bumped whenever a decoded instruction is overwritten
+    unsigned int cycleLimit = 0;    // run() stops after this many cycles, handlers cut it to stop early
+    unsigned int runCycles = 0;     // Cycles run() has emulated so far, superinstructions count both halves
+    bool fusionEnabled = true;      // See setFusion()
+    bool fusing = false;            // Set while run() lets superinstructions run both halves
+    uint64_t fusionDispatches[FUSION_COUNT];
+    uint64_t fusionHits[FUSION_COUNT];
+    bool idleLoopSkipping = true;   // See setIdleLoopSkipping()
+    bool loopPassed = false;        // op1NNNLoop just jumped back to the loop head
+    unsigned short loopEnd;         // Address of that jump
+    bool loopSnapshot = false;      // Set while the fields below hold the state at the last pass
+    unsigned short loopHead;        // pc, V, I, sp and the delay timer at the last pass
+    unsigned short loopI;
+    unsigned char loopV[16];
+    unsigned short loopSp;
+    unsigned char loopDelay;
+    uint64_t idleSkipped = 0;       // Cycles skipped in idle loops
 };
 
 
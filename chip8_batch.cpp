@@ -0,0 +1,523 @@
+#include "chip8_batch.h"
+#include "chip8.h"
+#include "rom_cache.h"
+#include "xorshift.h"
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const unsigned int LANES = Chip8Batch::LANES;
+
+// One byte per lane. Backed by one AVX2 register, two SSE2 registers, or plain bytes.
+// Loads and stores are unaligned, new does not honour over-aligned types before C++17.
+#if defined(__AVX2__)
+
+struct Lanes {
+    __m256i v;
+};
+
+inline Lanes load(const uint8_t* p) { return { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) }; }
+inline void store(uint8_t* p, Lanes a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v); }
+inline Lanes splat(uint8_t value) { return { _mm256_set1_epi8(static_cast<char>(value)) }; }
+inline Lanes operator+(Lanes a, Lanes b) { return { _mm256_add_epi8(a.v, b.v) }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { _mm256_sub_epi8(a.v, b.v) }; }
+inline Lanes operator&(Lanes a, Lanes b) { return { _mm256_and_si256(a.v, b.v) }; }
+inline Lanes operator|(Lanes a, Lanes b) { return { _mm256_or_si256(a.v, b.v) }; }
+inline Lanes operator^(Lanes a, Lanes b) { return { _mm256_xor_si256(a.v, b.v) }; }
+inline Lanes equal(Lanes a, Lanes b) { return { _mm256_cmpeq_epi8(a.v, b.v) }; }
+inline Lanes maxUnsigned(Lanes a, Lanes b) { return { _mm256_max_epu8(a.v, b.v) }; }
+inline Lanes subSaturate(Lanes a, Lanes b) { return { _mm256_subs_epu8(a.v, b.v) }; }
+inline Lanes shiftRight(Lanes a, int bits) { return Lanes { _mm256_srli_epi16(a.v, bits) } & splat(0xFF >> bits); }
+inline Lanes select(Lanes mask, Lanes a, Lanes b) { return { _mm256_blendv_epi8(b.v, a.v, mask.v) }; }
+
+// Bit n set where pc[n] & 0xFFF == address
+inline uint32_t lanesAt(const uint16_t* pc, uint16_t address) {
+    const __m256i* p = reinterpret_cast<const __m256i*>(pc);
+    __m256i wrap = _mm256_set1_epi16(0x0FFF);
+    __m256i target = _mm256_set1_epi16(static_cast<short>(address));
+    __m256i lo = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_loadu_si256(p), wrap), target);
+    __m256i hi = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_loadu_si256(p + 1), wrap), target);
+    // packs interleaves the 128-bit halves, the permute puts the lanes back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+    return static_cast<uint32_t>(_mm256_movemask_epi8(packed));
+}
+
+#elif defined(__SSE2__)
+
+struct Lanes {
+    __m128i lo;
+    __m128i hi;
+};
+
+inline Lanes load(const uint8_t* p) {
+    return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+             _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)) };
+}
+inline void store(uint8_t* p, Lanes a) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), a.hi);
+}
+inline Lanes splat(uint8_t value) { __m128i v = _mm_set1_epi8(static_cast<char>(value)); return { v, v }; }
+inline Lanes operator+(Lanes a, Lanes b) { return { _mm_add_epi8(a.lo, b.lo), _mm_add_epi8(a.hi, b.hi) }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { _mm_sub_epi8(a.lo, b.lo), _mm_sub_epi8(a.hi, b.hi) }; }
+inline Lanes operator&(Lanes a, Lanes b) { return { _mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi) }; }
+inline Lanes operator|(Lanes a, Lanes b) { return { _mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi) }; }
+inline Lanes operator^(Lanes a, Lanes b) { return { _mm_xor_si128(a.lo, b.lo), _mm_xor_si128(a.hi, b.hi) }; }
+inline Lanes equal(Lanes a, Lanes b) { return { _mm_cmpeq_epi8(a.lo, b.lo), _mm_cmpeq_epi8(a.hi, b.hi) }; }
+inline Lanes maxUnsigned(Lanes a, Lanes b) { return { _mm_max_epu8(a.lo, b.lo), _mm_max_epu8(a.hi, b.hi) }; }
+inline Lanes subSaturate(Lanes a, Lanes b) { return { _mm_subs_epu8(a.lo, b.lo), _mm_subs_epu8(a.hi, b.hi) }; }
+inline Lanes shiftRight(Lanes a, int bits) {
+    return Lanes { _mm_srli_epi16(a.lo, bits), _mm_srli_epi16(a.hi, bits) } & splat(0xFF >> bits);
+}
+inline Lanes select(Lanes mask, Lanes a, Lanes b) {
+    return { _mm_or_si128(_mm_and_si128(mask.lo, a.lo), _mm_andnot_si128(mask.lo, b.lo)),
+             _mm_or_si128(_mm_and_si128(mask.hi, a.hi), _mm_andnot_si128(mask.hi, b.hi)) };
+}
+
+// Bit n set where pc[n] & 0xFFF == address
+inline uint32_t lanesAt(const uint16_t* pc, uint16_t address) {
+    const __m128i* p = reinterpret_cast<const __m128i*>(pc);
+    __m128i wrap = _mm_set1_epi16(0x0FFF);
+    __m128i target = _mm_set1_epi16(static_cast<short>(address));
+    uint32_t bits = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m128i lo = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128(p + 2 * i), wrap), target);
+        __m128i hi = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128(p + 2 * i + 1), wrap), target);
+        bits |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(lo, hi))) << (16 * i);
+    }
+    return bits;
+}
+
+#else
+
+struct Lanes {
+    uint8_t b[LANES];
+};
+
+template <typename Op>
+inline Lanes map(Lanes a, Lanes b, Op op) {
+    Lanes r;
+    for (unsigned int i = 0; i < LANES; ++i) {
+        r.b[i] = op(a.b[i], b.b[i]);
+    }
+    return r;
+}
+
+inline Lanes load(const uint8_t* p) { Lanes r; std::memcpy(r.b, p, LANES); return r; }
+inline void store(uint8_t* p, Lanes a) { std::memcpy(p, a.b, LANES); }
+inline Lanes splat(uint8_t value) { Lanes r; std::memset(r.b, value, LANES); return r; }
+inline Lanes operator+(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x + y); }); }
+inline Lanes operator-(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x - y); }); }
+inline Lanes operator&(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x & y); }); }
+inline Lanes operator|(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x | y); }); }
+inline Lanes operator^(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x ^ y); }); }
+inline Lanes equal(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x == y ? 0xFF : 0); }); }
+inline Lanes maxUnsigned(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return x > y ? x : y; }); }
+inline Lanes subSaturate(Lanes a, Lanes b) { return map(a, b, [](uint8_t x, uint8_t y) { return (uint8_t) (x > y ? x - y : 0); }); }
+inline Lanes shiftRight(Lanes a, int bits) { return map(a, a, [bits](uint8_t x, uint8_t) { return (uint8_t) (x >> bits); }); }
+inline Lanes select(Lanes mask, Lanes a, Lanes b) { return (mask & a) | map(mask, b, [](uint8_t m, uint8_t y) { return (uint8_t) (~m & y); }); }
+
+// Bit n set where pc[n] & 0xFFF == address
+inline uint32_t lanesAt(const uint16_t* pc, uint16_t address) {
+    uint32_t bits = 0;
+    for (unsigned int lane = 0; lane < LANES; ++lane) {
+        bits |= (uint32_t) ((pc[lane] & 0x0FFF) == address) << lane;
+    }
+    return bits;
+}
+
+#endif
+
+// 1 where the byte mask is set, 0 elsewhere
+inline Lanes toBit(Lanes mask) { return mask & splat(1); }
+
+// Byte mask with 0xFF in lane n where bit n of bits is set
+inline Lanes fromBits(uint32_t bits) {
+    alignas(32) uint64_t spread[LANES / 8];
+    alignas(32) uint64_t selector[LANES / 8];
+    for (unsigned int i = 0; i < LANES / 8; ++i) {
+        // Copies source byte i into all eight bytes, byte n then keeps only bit n
+        spread[i] = ((bits >> (8 * i)) & 0xFF) * 0x0101010101010101ULL & 0x8040201008040201ULL;
+        selector[i] = 0x8040201008040201ULL;
+    }
+    return equal(load(reinterpret_cast<const uint8_t*>(spread)), load(reinterpret_cast<const uint8_t*>(selector)));
+}
+
+// pc increments: 0 outside mask, 4 where taken is set, 2 elsewhere
+inline Lanes stepBy(Lanes mask, Lanes taken) {
+    return mask & (splat(2) + (taken & splat(2)));
+}
+
+}
+
+void Chip8Batch::initialize(uint32_t seed) {
+    std::memset(V, 0, sizeof(V));
+    std::memset(delayTimer, 0, sizeof(delayTimer));
+    std::memset(soundTimer, 0, sizeof(soundTimer));
+    std::memset(I, 0, sizeof(I));
+    std::memset(stack, 0, sizeof(stack));
+    std::memset(sp, 0, sizeof(sp));
+    std::memset(keys, 0, sizeof(keys));
+    std::memset(gfx, 0, sizeof(gfx));
+    std::memset(memory, 0, sizeof(memory));
+    std::memset(written, 0, sizeof(written));
+
+    for (unsigned int lane = 0; lane < LANES; ++lane) {
+        pc[lane] = 0x200;
+        rng[lane] = xorshiftSeed(seed + lane);
+        std::memcpy(memory[lane], Chip8::chip8_fontset, sizeof(Chip8::chip8_fontset));
+    }
+    drawFlags = 0xFFFFFFFF;
+    faults = 0;
+}
+
+bool Chip8Batch::loadProgram(const RomImage& rom) {
+    if (rom.size() > sizeof(memory[0]) - 0x200) {
+        return false;
+    }
+    for (unsigned int lane = 0; lane < LANES; ++lane) {
+        std::memcpy(memory[lane] + 0x200, rom.data(), rom.size());
+    }
+    return true;
+}
+
+void Chip8Batch::step() {
+    uint32_t pending = ~faults;
+    while (pending != 0) {
+        // The lowest pending lane leads; every pending lane at its pc with the same opcode joins it
+        unsigned int leader = __builtin_ctz(pending);
+        unsigned short address = pc[leader] & 0x0FFF;
+        unsigned short next = (address + 1) & 0x0FFF;
+        unsigned char high = memory[leader][address];
+        unsigned char low = memory[leader][next];
+
+        uint32_t group = lanesAt(pc, address) & pending;
+        if (written[address] || written[next]) {
+            // Lanes may have stored different bytes here, compare each lane's own copy
+            for (uint32_t rest = group; rest != 0; rest &= rest - 1) {
+                unsigned int lane = __builtin_ctz(rest);
+                if (memory[lane][address] != high || memory[lane][next] != low) {
+                    group &= ~(1u << lane);
+                }
+            }
+        }
+        pending &= ~group;
+
+        unsigned short opcode = high << 8 | low;
+        if ((group & (group - 1)) == 0) {
+            executeLane(opcode, leader);
+        } else {
+            execute(opcode, group);
+        }
+    }
+}
+
+void Chip8Batch::execute(unsigned short opcode, uint32_t group) {
+    unsigned int x = (opcode & 0x0F00) >> 8;
+    unsigned int y = (opcode & 0x00F0) >> 4;
+    uint8_t nn = opcode & 0x00FF;
+
+    Lanes mask = fromBits(group);
+    Lanes none = splat(0);
+    alignas(32) uint8_t step[LANES];
+
+    Lanes vx = load(V[x]);
+    Lanes vy = load(V[y]);
+
+    switch (opcode & 0xF000) {
+        case 0x3000: // 0x3XNN, skip if Vx == NN
+            store(step, stepBy(mask, equal(vx, splat(nn))));
+            advance(step);
+            return;
+        case 0x4000: // 0x4XNN, skip if Vx != NN
+            store(step, stepBy(mask, equal(vx, splat(nn)) ^ splat(0xFF)));
+            advance(step);
+            return;
+        case 0x5000: // 0x5XY0, skip if Vx == Vy
+            store(step, stepBy(mask, equal(vx, vy)));
+            advance(step);
+            return;
+        case 0x9000: // 0x9XY0, skip if Vx != Vy
+            store(step, stepBy(mask, equal(vx, vy) ^ splat(0xFF)));
+            advance(step);
+            return;
+        case 0x6000: // 0x6XNN, Vx = NN
+            store(V[x], select(mask, splat(nn), vx));
+            store(step, stepBy(mask, none));
+            advance(step);
+            return;
+        case 0x7000: // 0x7XNN, Vx += NN
+            store(V[x], select(mask, vx + splat(nn), vx));
+            store(step, stepBy(mask, none));
+            advance(step);
+            return;
+        case 0x8000: {
+            // Flag ops write Vx first and VF last, so VF wins when X is F, as in Chip8
+            Lanes result;
+            bool flag = true;
+            Lanes carry;
+            switch (opcode & 0x000F) {
+                case 0x0: result = vy; flag = false; break;
+                case 0x1: result = vx | vy; flag = false; break;
+                case 0x2: result = vx & vy; flag = false; break;
+                case 0x3: result = vx ^ vy; flag = false; break;
+                case 0x4: // Carry when the sum wrapped below Vx
+                    result = vx + vy;
+                    carry = toBit(equal(maxUnsigned(result, vx), result) ^ splat(0xFF));
+                    break;
+                case 0x5: // VF = 1 when Vx >= Vy
+                    result = vx - vy;
+                    carry = toBit(equal(maxUnsigned(vx, vy), vx));
+                    break;
+                case 0x6:
+                    result = shiftRight(vx, 1);
+                    carry = vx & splat(1);
+                    break;
+                case 0x7: // VF = 1 when Vy >= Vx
+                    result = vy - vx;
+                    carry = toBit(equal(maxUnsigned(vy, vx), vy));
+                    break;
+                case 0xE:
+                    result = vx + vx;
+                    carry = shiftRight(vx, 7);
+                    break;
+                default:
+                    return; // Unknown opcode, pc stays
+            }
+            store(V[x], select(mask, result, vx));
+            if (flag) {
+                store(V[0xF], select(mask, carry, load(V[0xF])));
+            }
+            store(step, stepBy(mask, none));
+            advance(step);
+            return;
+        }
+        case 0xF000:
+            switch (nn) {
+                case 0x07: // Vx = delay_timer
+                    store(V[x], select(mask, load(delayTimer), vx));
+                    store(step, stepBy(mask, none));
+                    advance(step);
+                    return;
+                case 0x15: // delay_timer = Vx
+                    store(delayTimer, select(mask, vx, load(delayTimer)));
+                    store(step, stepBy(mask, none));
+                    advance(step);
+                    return;
+                case 0x18: // sound_timer = Vx
+                    store(soundTimer, select(mask, vx, load(soundTimer)));
+                    store(step, stepBy(mask, none));
+                    advance(step);
+                    return;
+            }
+            break;
+    }
+
+    // No kernel, run the lanes one by one
+    for (uint32_t rest = group; rest != 0; rest &= rest - 1) {
+        executeLane(opcode, __builtin_ctz(rest));
+    }
+}
+
+void Chip8Batch::executeLane(unsigned short opcode, unsigned int lane) {
+    unsigned int x = (opcode & 0x0F00) >> 8;
+    unsigned int y = (opcode & 0x00F0) >> 4;
+    unsigned short nnn = opcode & 0x0FFF;
+    uint8_t nn = opcode & 0x00FF;
+    uint8_t* mem = memory[lane];
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if ((opcode & 0x000F) == 0x0000) {          // 00E0
+                for (int row = 0; row < 32; ++row) {
+                    gfx[row][lane] = 0;
+                }
+                drawFlags |= 1u << lane;
+                pc[lane] += 2;
+            } else if ((opcode & 0x000F) == 0x000E) {   // 00EE
+                if (sp[lane] == 0) {
+                    faults |= 1u << lane;
+                    break;
+                }
+                --sp[lane];
+                pc[lane] = stack[sp[lane]][lane] + 2;
+            }
+            break;
+        case 0x1000:
+            pc[lane] = nnn;
+            break;
+        case 0x2000:
+            if (sp[lane] == 16) {
+                faults |= 1u << lane;
+                break;
+            }
+            stack[sp[lane]][lane] = pc[lane];
+            ++sp[lane];
+            pc[lane] = nnn;
+            break;
+        case 0x3000:
+            pc[lane] += (V[x][lane] == nn) ? 4 : 2;
+            break;
+        case 0x4000:
+            pc[lane] += (V[x][lane] != nn) ? 4 : 2;
+            break;
+        case 0x5000:
+            pc[lane] += (V[x][lane] == V[y][lane]) ? 4 : 2;
+            break;
+        case 0x6000:
+            V[x][lane] = nn;
+            pc[lane] += 2;
+            break;
+        case 0x7000:
+            V[x][lane] += nn;
+            pc[lane] += 2;
+            break;
+        case 0x8000: {
+            uint8_t vx = V[x][lane];
+            uint8_t vy = V[y][lane];
+            uint8_t flag;
+            switch (opcode & 0x000F) {
+                case 0x0: V[x][lane] = vy; break;
+                case 0x1: V[x][lane] = vx | vy; break;
+                case 0x2: V[x][lane] = vx & vy; break;
+                case 0x3: V[x][lane] = vx ^ vy; break;
+                case 0x4: flag = vy > 0xFF - vx; V[x][lane] = vx + vy; V[0xF][lane] = flag; break;
+                case 0x5: flag = vx >= vy; V[x][lane] = vx - vy; V[0xF][lane] = flag; break;
+                case 0x6: flag = vx & 1; V[x][lane] = vx >> 1; V[0xF][lane] = flag; break;
+                case 0x7: flag = vy >= vx; V[x][lane] = vy - vx; V[0xF][lane] = flag; break;
+                case 0xE: flag = vx >> 7; V[x][lane] = vx << 1; V[0xF][lane] = flag; break;
+                default: return; // Unknown opcode, pc stays
+            }
+            pc[lane] += 2;
+            break;
+        }
+        case 0x9000:
+            pc[lane] += (V[x][lane] != V[y][lane]) ? 4 : 2;
+            break;
+        case 0xA000:
+            I[lane] = nnn;
+            pc[lane] += 2;
+            break;
+        case 0xB000:
+            pc[lane] = nnn + V[0][lane];
+            break;
+        case 0xC000:
+            V[x][lane] = xorshiftByte(rng[lane]) & nn;
+            pc[lane] += 2;
+            break;
+        case 0xD000: {
+            unsigned int px = V[x][lane] & 63;
+            unsigned int py = V[y][lane] & 31;
+            uint64_t collision = 0;
+            for (unsigned int line = 0; line < (opcode & 0x000Fu); ++line) {
+                uint64_t sprite = (uint64_t) mem[(I[lane] + line) & 0x0FFF] << 56;
+                sprite = (sprite >> px) | (sprite << ((64 - px) & 63));
+                uint64_t& row = gfx[(py + line) & 31][lane];
+                collision |= row & sprite;
+                row ^= sprite;
+            }
+            V[0xF][lane] = collision != 0 ? 1 : 0;
+            drawFlags |= 1u << lane;
+            pc[lane] += 2;
+            break;
+        }
+        case 0xE000: {
+            bool pressed = (keys[lane] >> (V[x][lane] & 0xF)) & 1;
+            if ((opcode & 0x000F) == 0x000E) {          // EX9E
+                pc[lane] += pressed ? 4 : 2;
+            } else if ((opcode & 0x000F) == 0x0001) {   // EXA1
+                pc[lane] += pressed ? 2 : 4;
+            }
+            break;
+        }
+        case 0xF000:
+            switch (nn) {
+                case 0x07:
+                    V[x][lane] = delayTimer[lane];
+                    pc[lane] += 2;
+                    break;
+                case 0x0A: // Wait for a key: stay on this instruction until one is down
+                    if (keys[lane] != 0) {
+                        V[x][lane] = __builtin_ctz(keys[lane]);
+                        pc[lane] += 2;
+                    }
+                    break;
+                case 0x15:
+                    delayTimer[lane] = V[x][lane];
+                    pc[lane] += 2;
+                    break;
+                case 0x18:
+                    soundTimer[lane] = V[x][lane];
+                    pc[lane] += 2;
+                    break;
+                case 0x1E: // Wraps at the end of memory like Chip8's I
+                    I[lane] = (I[lane] + V[x][lane]) & 0x0FFF;
+                    pc[lane] += 2;
+                    break;
+                case 0x29:
+                    I[lane] = V[x][lane] * 5;
+                    pc[lane] += 2;
+                    break;
+                case 0x33:
+                    mem[I[lane] & 0x0FFF] = V[x][lane] / 100;
+                    mem[(I[lane] + 1) & 0x0FFF] = (V[x][lane] / 10) % 10;
+                    mem[(I[lane] + 2) & 0x0FFF] = V[x][lane] % 10;
+                    markWritten(I[lane], 3);
+                    pc[lane] += 2;
+                    break;
+                case 0x55:
+                    for (unsigned int reg = 0; reg <= x; ++reg) {
+                        mem[(I[lane] + reg) & 0x0FFF] = V[reg][lane];
+                    }
+                    markWritten(I[lane], x + 1);
+                    pc[lane] += 2;
+                    break;
+                case 0x65:
+                    for (unsigned int reg = 0; reg <= x; ++reg) {
+                        V[reg][lane] = mem[(I[lane] + reg) & 0x0FFF];
+                    }
+                    pc[lane] += 2;
+                    break;
+            }
+            break;
+    }
+}
+
+void Chip8Batch::markWritten(unsigned short address, unsigned int length) {
+    for (unsigned int i = 0; i < length; ++i) {
+        written[(address + i) & 0x0FFF] = true;
+    }
+}
+
+void Chip8Batch::advance(const uint8_t* step) {
+    for (unsigned int lane = 0; lane < LANES; ++lane) {
+        pc[lane] += step[lane];
+    }
+}
+
+void Chip8Batch::tickTimers() {
+    store(delayTimer, subSaturate(load(delayTimer), splat(1)));
+    store(soundTimer, subSaturate(load(soundTimer), splat(1)));
+}
+
+void Chip8Batch::setKeys(unsigned int lane, uint16_t keys) {
+    this->keys[lane] = keys;
+}
+
+uint32_t Chip8Batch::getDrawFlags() const {
+    return drawFlags;
+}
+
+void Chip8Batch::clearDrawFlags() {
+    drawFlags = 0;
+}
+
+void Chip8Batch::getFramebuffer(unsigned int lane, uint64_t* rows) const {
+    for (int row = 0; row < 32; ++row) {
+        rows[row] = gfx[row][lane];
+    }
+}
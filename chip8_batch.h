@@ -0,0 +1,93 @@
+#ifndef CHIP8_CHIP8_BATCH_H
+#define CHIP8_CHIP8_BATCH_H
+
+#include <cstdint>
+
+class RomImage;
+
+// Runs LANES Chip8 machines in lockstep, with their state kept in structure-of-arrays
+// layout: V[reg][lane], I[lane], pc[lane], ... Every step() executes one instruction on
+// every lane. Lanes at the same pc with the same opcode form a group and run together:
+// register, ALU, skip and timer instructions as AVX2/SSE2 kernels over all lanes with
+// the group as a mask, everything else per lane. Lanes that diverge simply form more,
+// smaller groups, and a group of one runs on the scalar path.
+//
+// The scalar Chip8 class stays the reference implementation and lanes follow its
+// PLATFORM_CHIP8 semantics with its default QUIRKS_MODERN; SUPER-CHIP and XO-CHIP programs, and
+// other quirks, need a Chip8. A lane waiting in Fx0A stays on the instruction until setKeys()
+// presses a key, like Chip8's wait state, but still re-runs it on every step. A lane whose
+// 2NNN or 00EE overflows or underflows its stack stops on it like Chip8's stack faults:
+// getFaults() reports it and step() no longer runs it.
+class Chip8Batch {
+public:
+    // Number of machines
+    static const unsigned int LANES = 32;
+
+    Chip8Batch() = default;
+
+    Chip8Batch(const Chip8Batch&) = delete;
+    Chip8Batch& operator=(const Chip8Batch&) = delete;
+
+    // Resets every lane. Lane n draws the CXNN random numbers of a Chip8 initialized with seed + n.
+    void initialize(uint32_t seed);
+
+    // Loads the same program into every lane. Returns false if it doesn't fit the 4K of a lane.
+    bool loadProgram(const RomImage& rom);
+
+    // Executes one instruction on every lane
+    void step();
+
+    // Counts the delay and sound timers of every lane down by one. Call at 60 Hz.
+    void tickTimers();
+
+    // Sets the pressed keys of lane, bit n for key n
+    void setKeys(unsigned int lane, uint16_t keys);
+
+    // Returns the lanes stopped on a stack fault, bit n for lane n
+    uint32_t getFaults() const { return faults; }
+
+    // Returns the lanes whose screen changed since the flags were last cleared, bit n for lane n
+    uint32_t getDrawFlags() const;
+
+    // Clears the draw flags of all lanes
+    void clearDrawFlags();
+
+    // Copies the 32 packed screen rows of lane to rows, the leftmost pixel in the most significant bit
+    void getFramebuffer(unsigned int lane, uint64_t* rows) const;
+
+    // Register accessors for inspecting a lane
+    uint8_t getV(unsigned int lane, unsigned int reg) const { return V[reg][lane]; }
+    uint16_t getI(unsigned int lane) const { return I[lane]; }
+    uint16_t getPc(unsigned int lane) const { return pc[lane]; }
+    uint8_t getDelayTimer(unsigned int lane) const { return delayTimer[lane]; }
+
+private:
+    // Executes opcode on the lanes set in group
+    void execute(unsigned short opcode, uint32_t group);
+
+    // Executes opcode on a single lane
+    void executeLane(unsigned short opcode, unsigned int lane);
+
+    // Records a store by some lane to length bytes at address
+    void markWritten(unsigned short address, unsigned int length);
+
+    // Adds step[lane] to the pc of every lane
+    void advance(const uint8_t* step);
+
+    uint8_t V[16][LANES];           // Registers, one row of lanes per register
+    uint8_t delayTimer[LANES];
+    uint8_t soundTimer[LANES];
+    uint16_t I[LANES];
+    uint16_t pc[LANES];
+    uint16_t stack[16][LANES];
+    uint8_t sp[LANES];
+    uint16_t keys[LANES];           // Pressed keys, bit n for key n
+    uint32_t rng[LANES];            // CXNN generator state, see xorshift.h
+    uint64_t gfx[32][LANES];        // Packed screen rows, one row of lanes per screen row
+    uint32_t drawFlags = 0;
+    uint32_t faults = 0;            // Lanes stopped on a stack fault
+    uint8_t memory[LANES][4096];    // Each lane owns its memory, programs may write to it
+    bool written[4096];             // Addresses stored to by any lane, the only ones where lanes may differ
+};
+
+#endif //CHIP8_CHIP8_BATCH_H
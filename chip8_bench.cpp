@@ -0,0 +1,249 @@
+#include "chip8.h"
+#include "chip8_batch.h"
+#include "chip8_jit.h"
+#include "chip8_threaded.h"
+#include "rom_cache.h"
+#include "scheduler.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Measures emulated instructions per second on synthetic microbenchmark ROMs, one per
+// opcode class, and on a real ROM. Results are printed as JSON. The batch engine counts the
+// instructions of all its lanes.
+// Usage: chip8-bench [--rom <path>] [--instructions N] [--repeat R] [--ipf N]
+
+#ifndef CHIP8_DEFAULT_ROM
+#define CHIP8_DEFAULT_ROM "PONG"
+#endif
+
+namespace {
+
+// Opcodes placed at their addresses
+typedef std::vector<std::pair<unsigned short, unsigned short>> Program;
+
+struct Benchmark {
+    std::string name;
+    std::shared_ptr<const RomImage> rom;
+};
+
+struct Result {
+    double mips;
+    double mipsVariance;
+    double mipsStddev;
+    double nsPerInstruction;
+};
+
+// Assembles a program into a ROM image loaded at 0x200
+std::shared_ptr<const RomImage> assemble(const Program& program) {
+    std::vector<unsigned char> bytes;
+    for (const auto& op : program) {
+        size_t offset = op.first - 0x200;
+        if (bytes.size() < offset + 2) {
+            bytes.resize(offset + 2);
+        }
+        bytes[offset] = op.second >> 8;
+        bytes[offset + 1] = op.second & 0xFF;
+    }
+    return RomCache::instance().add(bytes.data(), bytes.size());
+}
+
+// 8XYn arithmetic and logic in a tight loop
+Program aluProgram() {
+    return {
+            {0x200, 0x6001}, {0x202, 0x6103}, {0x204, 0x6255},
+            {0x206, 0x8014}, {0x208, 0x8105}, {0x20A, 0x8021}, {0x20C, 0x8122},
+            {0x20E, 0x8013}, {0x210, 0x8106}, {0x212, 0x801E}, {0x214, 0x8017},
+            {0x216, 0x8120}, {0x218, 0x1206},
+    };
+}
+
+// Font sprites drawn all over the screen
+Program spriteProgram() {
+    return {
+            {0x200, 0xA000}, {0x202, 0x6000}, {0x204, 0x6100},
+            {0x206, 0xD015}, {0x208, 0x7007}, {0x20A, 0x7103}, {0x20C, 0xD01F},
+            {0x20E, 0x1206},
+    };
+}
+
+// Nested subroutine calls four deep
+Program callProgram() {
+    return {
+            {0x200, 0x2300}, {0x202, 0x1200},
+            {0x300, 0x2310}, {0x302, 0x00EE},
+            {0x310, 0x2320}, {0x312, 0x00EE},
+            {0x320, 0x2330}, {0x322, 0x00EE},
+            {0x330, 0x00EE},
+    };
+}
+
+// All sixteen registers stored to and loaded from data memory
+Program bulkMoveProgram() {
+    return {
+            {0x200, 0xA800}, {0x202, 0xFF55}, {0x204, 0xFF65}, {0x206, 0x7001},
+            {0x208, 0x1202},
+    };
+}
+
+enum Engine {
+    INTERPRETER,
+    THREADED,
+    JIT,
+    BATCH
+};
+
+const char* const ENGINE_NAMES[] = {"interpreter", "threaded", "jit", "batch32"};
+
+// Runs one repetition, adding the number of instructions executed to executed.
+// Returns false if the program doesn't fit the engine's memory.
+bool runOnce(const RomImage& rom, Engine engine, unsigned long long instructions,
+             unsigned int instructionsPerFrame, unsigned long long& executed) {
+    executed = 0;
+    if (engine == BATCH) {
+        std::unique_ptr<Chip8Batch> batch(new Chip8Batch());
+        batch->initialize(1);
+        if (!batch->loadProgram(rom)) {
+            return false;
+        }
+        while (executed < instructions && batch->getFaults() != 0xFFFFFFFF) {
+            for (unsigned int i = 0; i < instructionsPerFrame; ++i) {
+                batch->step();
+            }
+            batch->tickTimers();
+            executed += (unsigned long long) instructionsPerFrame * Chip8Batch::LANES;
+        }
+        return true;
+    }
+
+    // Idle loops are executed, so MIPS measure instructions actually run
+    std::unique_ptr<Chip8> chip8(new Chip8());
+    chip8->initialize();
+    if (!chip8->loadProgram(rom)) {
+        return false;
+    }
+    chip8->setIdleLoopSkipping(false);
+
+    std::unique_ptr<Chip8Jit> jit(new Chip8Jit(*chip8));
+    Chip8Threaded threaded(*chip8);
+    Scheduler scheduler(*chip8);
+    scheduler.setInstructionsPerFrame(instructionsPerFrame);
+    scheduler.setUncapped(true);
+    if (engine == JIT) {
+        scheduler.setJit(jit.get());
+    } else if (engine == THREADED) {
+        scheduler.setThreaded(&threaded);
+    }
+    while (executed < instructions && !chip8->isIdle()) {
+        executed += scheduler.runFrame();
+    }
+    return true;
+}
+
+// Runs repeat repetitions into result. Returns false if the program doesn't fit the engine's memory.
+bool run(const RomImage& rom, Engine engine, unsigned long long instructions, unsigned int repeat,
+         unsigned int instructionsPerFrame, Result& result) {
+    std::vector<double> mips;
+    double totalSeconds = 0;
+    unsigned long long totalInstructions = 0;
+
+    for (unsigned int r = 0; r < repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long executed;
+        if (!runOnce(rom, engine, instructions, instructionsPerFrame, executed)) {
+            return false;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        mips.push_back(executed / seconds / 1e6);
+        totalSeconds += seconds;
+        totalInstructions += executed;
+    }
+
+    double mean = 0;
+    for (double m : mips) {
+        mean += m;
+    }
+    mean /= mips.size();
+    double variance = 0;
+    for (double m : mips) {
+        variance += (m - mean) * (m - mean);
+    }
+    variance /= mips.size();
+
+    result.mips = mean;
+    result.mipsVariance = variance;
+    result.mipsStddev = std::sqrt(variance);
+    result.nsPerInstruction = totalSeconds * 1e9 / totalInstructions;
+    return true;
+}
+
+}
+
+int main(int argc, char* args[]) {
+    std::string romPath = CHIP8_DEFAULT_ROM;
+    unsigned long long instructions = 10000000;
+    unsigned int repeat = 5;
+    unsigned int instructionsPerFrame = 10;
+
+    for (int argi = 1; argi < argc; ++argi) {
+        if (std::strcmp(args[argi], "--rom") == 0 && argi + 1 < argc) {
+            romPath = args[++argi];
+        } else if (std::strcmp(args[argi], "--instructions") == 0 && argi + 1 < argc) {
+            instructions = std::strtoull(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--repeat") == 0 && argi + 1 < argc) {
+            repeat = std::strtoul(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--ipf") == 0 && argi + 1 < argc) {
+            instructionsPerFrame = std::strtoul(args[++argi], nullptr, 10);
+        } else {
+            printf("Usage: %s [--rom <path>] [--instructions N] [--repeat R] [--ipf N]\n", args[0]);
+            return 1;
+        }
+    }
+    if (repeat == 0 || instructionsPerFrame == 0) {
+        printf("--repeat and --ipf must be positive\n");
+        return 1;
+    }
+
+    std::vector<Benchmark> benchmarks = {
+            {"alu_8xyn", assemble(aluProgram())},
+            {"sprite_dxyn", assemble(spriteProgram())},
+            {"call_return", assemble(callProgram())},
+            {"bulk_fx55_fx65", assemble(bulkMoveProgram())},
+    };
+
+    std::string error;
+    std::shared_ptr<const RomImage> rom = RomCache::instance().load(romPath, &error);
+    if (rom == nullptr) {
+        fprintf(stderr, "Skipping ROM benchmark: %s\n", error.c_str());
+    } else {
+        benchmarks.push_back({"rom:" + romPath, rom});
+    }
+
+    printf("{\n  \"instructions\": %llu,\n  \"repeat\": %u,\n  \"instructions_per_frame\": %u,\n  \"results\": [\n",
+           instructions, repeat, instructionsPerFrame);
+    bool first = true;
+    for (const Benchmark& benchmark : benchmarks) {
+        for (Engine engine : {INTERPRETER, THREADED, JIT, BATCH}) {
+            Result result;
+            if (!run(*benchmark.rom, engine, instructions, repeat, instructionsPerFrame, result)) {
+                fprintf(stderr, "Skipping %s on %s: the program doesn't fit in 4K\n", benchmark.name.c_str(),
+                        ENGINE_NAMES[engine]);
+                continue;
+            }
+            printf("%s    {\"name\": \"%s\", \"engine\": \"%s\", \"mips\": %.3f, \"mips_variance\": %.4f, "
+                   "\"mips_stddev\": %.3f, \"ns_per_instruction\": %.3f}",
+                   first ? "" : ",\n", benchmark.name.c_str(), ENGINE_NAMES[engine],
+                   result.mips, result.mipsVariance, result.mipsStddev, result.nsPerInstruction);
+            first = false;
+        }
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,460 @@
+#include "chip8.h"
+#include "frame_recorder.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Exports a frame recording written by FrameRecorder (chip8 and chip8-run --capture) as a
+// numbered PNG per record, <prefix>NNNNNN.png after the frame number, or as one animated GIF.
+// Screens are drawn like the SDL frontend: onto a 128x64 canvas with lo-res pixels doubled,
+// in its palette, then scaled up. The GIF plays at the recorded speed, sampled at 50 Hz, the
+// finest step viewers honour.
+// Usage: chip8-export [--scale N] [--from <frame>] [--to <frame>] (--png <prefix> | --gif <file>) <recording>
+
+namespace {
+
+// As the SDL frontend, plane bits to RGB
+const unsigned char PALETTE[4][3] = { {0x00, 0x00, 0x00}, {0xFF, 0xFF, 0xFF}, {0xFF, 0x80, 0x00}, {0x80, 0x80, 0x80} };
+
+// GIF frame step in centiseconds, shorter delays are slowed down by most viewers
+const unsigned int GIF_STEP = 2;
+
+// An image of PALETTE indices
+struct Image {
+    unsigned int width;
+    unsigned int height;
+    std::vector<unsigned char> pixels;
+};
+
+// Draws frame onto the canvas, scale pixels per canvas pixel
+void render(const RecordedFrame& frame, unsigned int scale, Image& image) {
+    image.width = Chip8::MAX_WIDTH * scale;
+    image.height = Chip8::MAX_HEIGHT * scale;
+    image.pixels.resize(image.width * image.height);
+    unsigned int zoom = Chip8::MAX_WIDTH / frame.width * scale;
+    for (unsigned int y = 0; y < image.height; ++y) {
+        const unsigned char* row = frame.pixels.data() + (y / zoom) * frame.width;
+        unsigned char* out = image.pixels.data() + y * image.width;
+        for (unsigned int x = 0; x < image.width; ++x) {
+            out[x] = row[x / zoom] & 0x3;
+        }
+    }
+}
+
+void putU16(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void putU32BigEndian(std::vector<unsigned char>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+uint32_t crc32(const unsigned char* data, size_t size) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+void putPngChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+    putU32BigEndian(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putU32BigEndian(out, crc32(out.data() + start, out.size() - start));
+}
+
+// Encodes image as a 2-bit palette PNG. The zlib stream uses stored blocks, which keeps this
+// free of a compression library; at 2 bits per pixel the files stay small enough.
+void encodePng(const Image& image, std::vector<unsigned char>& out) {
+    static const unsigned char SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.assign(SIGNATURE, SIGNATURE + 8);
+
+    std::vector<unsigned char> chunk;
+    putU32BigEndian(chunk, image.width);
+    putU32BigEndian(chunk, image.height);
+    chunk.push_back(2);     // Bit depth
+    chunk.push_back(3);     // Palette colour type
+    chunk.push_back(0);     // Deflate
+    chunk.push_back(0);     // Adaptive filtering
+    chunk.push_back(0);     // Not interlaced
+    putPngChunk(out, "IHDR", chunk);
+
+    chunk.clear();
+    for (const unsigned char* color : PALETTE) {
+        chunk.insert(chunk.end(), color, color + 3);
+    }
+    putPngChunk(out, "PLTE", chunk);
+
+    // Scanlines, each a filter byte of 0 and four pixels per byte, leftmost in the high bits
+    std::vector<unsigned char> raw;
+    size_t stride = (image.width + 3) / 4;
+    raw.reserve((stride + 1) * image.height);
+    for (unsigned int y = 0; y < image.height; ++y) {
+        raw.push_back(0);
+        const unsigned char* row = image.pixels.data() + y * image.width;
+        for (size_t byte = 0; byte < stride; ++byte) {
+            unsigned char packed = 0;
+            for (unsigned int i = 0; i < 4; ++i) {
+                unsigned int x = byte * 4 + i;
+                packed |= (x < image.width ? row[x] : 0) << (6 - 2 * i);
+            }
+            raw.push_back(packed);
+        }
+    }
+
+    chunk.assign({0x78, 0x01});
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (unsigned char byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    size_t offset = 0;
+    do {
+        size_t size = raw.size() - offset < 0xFFFF ? raw.size() - offset : 0xFFFF;
+        chunk.push_back(offset + size == raw.size() ? 1 : 0);
+        putU16(chunk, size);
+        putU16(chunk, ~size & 0xFFFF);
+        chunk.insert(chunk.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while (offset < raw.size());
+    putU32BigEndian(chunk, (b << 16) | a);
+    putPngChunk(out, "IDAT", chunk);
+
+    chunk.clear();
+    putPngChunk(out, "IEND", chunk);
+}
+
+// Packs GIF LZW codes, least significant bit first, into 255-byte data sub-blocks
+class GifCodeWriter {
+public:
+    explicit GifCodeWriter(std::vector<unsigned char>& out) : out(out) {}
+
+    void put(unsigned int code, unsigned int size) {
+        bits |= code << count;
+        count += size;
+        while (count >= 8) {
+            putByte(bits & 0xFF);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void finish() {
+        if (count > 0) {
+            putByte(bits & 0xFF);
+        }
+        if (!block.empty()) {
+            out.push_back(block.size());
+            out.insert(out.end(), block.begin(), block.end());
+        }
+        out.push_back(0);
+    }
+
+private:
+    void putByte(unsigned char byte) {
+        block.push_back(byte);
+        if (block.size() == 255) {
+            out.push_back(255);
+            out.insert(out.end(), block.begin(), block.end());
+            block.clear();
+        }
+    }
+
+    std::vector<unsigned char>& out;
+    std::vector<unsigned char> block;
+    uint32_t bits = 0;
+    unsigned int count = 0;
+};
+
+// Appends the LZW image data of image, whose pixels are 2-bit palette indices
+void encodeGifPixels(const Image& image, std::vector<unsigned char>& out) {
+    const unsigned int MIN_CODE_SIZE = 2;
+    const unsigned int CLEAR = 1 << MIN_CODE_SIZE;
+    const unsigned int END = CLEAR + 1;
+    const unsigned int MAX_CODES = 4096;
+    out.push_back(MIN_CODE_SIZE);
+
+    // Code of every string extended by one of the four colours, 0 where there is none yet
+    std::vector<uint16_t> next(MAX_CODES * 4);
+    unsigned int nextCode = END + 1;
+    unsigned int codeSize = MIN_CODE_SIZE + 1;
+    GifCodeWriter writer(out);
+    writer.put(CLEAR, codeSize);
+
+    unsigned int prefix = image.pixels[0];
+    for (size_t i = 1; i < image.pixels.size(); ++i) {
+        unsigned int pixel = image.pixels[i];
+        uint16_t& code = next[prefix * 4 + pixel];
+        if (code != 0) {
+            prefix = code;
+            continue;
+        }
+        writer.put(prefix, codeSize);
+        if (nextCode < MAX_CODES) {
+            code = nextCode++;
+            // The decoder's table runs one code behind, it widens when this one is due
+            if (nextCode > (1u << codeSize) && codeSize < 12) {
+                ++codeSize;
+            }
+        } else {
+            // Table full, start over rather than emit ever longer stale strings
+            writer.put(CLEAR, codeSize);
+            std::fill(next.begin(), next.end(), 0);
+            nextCode = END + 1;
+            codeSize = MIN_CODE_SIZE + 1;
+        }
+        prefix = pixel;
+    }
+    writer.put(prefix, codeSize);
+    writer.put(END, codeSize);
+    writer.finish();
+}
+
+// Builds an animated GIF out of images of one size. A frame only stores the rectangle that
+// changed since the frame before, drawn over it, and an unchanged image lengthens the delay of
+// the frame before instead of adding one.
+class GifWriter {
+public:
+    GifWriter(unsigned int width, unsigned int height) {
+        const char* signature = "GIF89a";
+        out.insert(out.end(), signature, signature + 6);
+        putU16(out, width);
+        putU16(out, height);
+        out.push_back(0x81);    // Global colour table of 2^(1 + 1) entries
+        out.push_back(0);       // Background colour
+        out.push_back(0);       // No aspect ratio
+        for (const unsigned char* color : PALETTE) {
+            out.insert(out.end(), color, color + 3);
+        }
+
+        // Loop forever
+        const unsigned char loop[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+                                       0x03, 0x01, 0x00, 0x00, 0x00 };
+        out.insert(out.end(), loop, loop + sizeof(loop));
+    }
+
+    // Appends image shown for delay centiseconds
+    void add(const Image& image, uint64_t delay) {
+        if (frameCount > 0 && image.pixels == shown.pixels && shownDelay + delay <= 0xFFFF) {
+            shownDelay += delay;
+            out[delayOffset] = shownDelay & 0xFF;
+            out[delayOffset + 1] = shownDelay >> 8;
+            return;
+        }
+
+        // Bounding box of the changed pixels, all of the first image. An unchanged image only
+        // gets here when the delay field is full, and then repeats a single pixel.
+        unsigned int left = 0;
+        unsigned int top = 0;
+        unsigned int right = 1;
+        unsigned int bottom = 1;
+        if (frameCount == 0) {
+            right = image.width;
+            bottom = image.height;
+        } else {
+            bool changed = false;
+            for (unsigned int y = 0; y < image.height; ++y) {
+                for (unsigned int x = 0; x < image.width; ++x) {
+                    if (image.pixels[x + y * image.width] != shown.pixels[x + y * image.width]) {
+                        left = changed ? std::min(left, x) : x;
+                        right = changed ? std::max(right, x + 1) : x + 1;
+                        top = changed ? top : y;
+                        bottom = y + 1;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        Image crop;
+        crop.width = right - left;
+        crop.height = bottom - top;
+        for (unsigned int y = top; y < bottom; ++y) {
+            const unsigned char* row = image.pixels.data() + y * image.width;
+            crop.pixels.insert(crop.pixels.end(), row + left, row + right);
+        }
+
+        // Graphic control: keep the frame for the next to draw over, delay, no transparency
+        const unsigned char control[] = { 0x21, 0xF9, 0x04, 0x04 };
+        out.insert(out.end(), control, control + sizeof(control));
+        shownDelay = std::min<uint64_t>(delay, 0xFFFF);
+        delayOffset = out.size();
+        putU16(out, shownDelay);
+        out.push_back(0);
+        out.push_back(0);
+
+        out.push_back(0x2C);
+        putU16(out, left);
+        putU16(out, top);
+        putU16(out, crop.width);
+        putU16(out, crop.height);
+        out.push_back(0);       // Global colour table, not interlaced
+        encodeGifPixels(crop, out);
+        shown = image;
+        ++frameCount;
+
+        if (delay > shownDelay) {
+            add(image, delay - shownDelay);
+        }
+    }
+
+    // Returns the GIF, ended
+    const std::vector<unsigned char>& finish() {
+        out.push_back(0x3B);
+        return out;
+    }
+
+    size_t getFrameCount() const {
+        return frameCount;
+    }
+
+private:
+    std::vector<unsigned char> out;
+    Image shown = Image();          // Image after the last frame
+    uint64_t shownDelay = 0;
+    size_t delayOffset = 0;         // Where the delay of the last frame is in out
+    size_t frameCount = 0;
+};
+
+bool writeFile(const std::string& path, const std::vector<unsigned char>& data) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && written;
+}
+
+// Centiseconds from frame first to frame number, at 60 frames per second
+uint64_t centiseconds(uint64_t first, uint64_t number) {
+    return (number - first) * 100 / 60;
+}
+
+}
+
+int main(int argc, char* args[]) {
+    unsigned int scale = 4;
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    const char* pngPrefix = nullptr;
+    const char* gifPath = nullptr;
+    const char* recording = nullptr;
+    for (int argi = 1; argi < argc; ++argi) {
+        if (std::strcmp(args[argi], "--scale") == 0 && argi + 1 < argc) {
+            scale = std::strtoul(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--from") == 0 && argi + 1 < argc) {
+            from = std::strtoull(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--to") == 0 && argi + 1 < argc) {
+            to = std::strtoull(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--png") == 0 && argi + 1 < argc) {
+            pngPrefix = args[++argi];
+        } else if (std::strcmp(args[argi], "--gif") == 0 && argi + 1 < argc) {
+            gifPath = args[++argi];
+        } else if (recording == nullptr) {
+            recording = args[argi];
+        } else {
+            recording = nullptr;
+            break;
+        }
+    }
+    if (recording == nullptr || (pngPrefix == nullptr) == (gifPath == nullptr) || scale == 0 || scale > 16) {
+        printf("Usage: %s [--scale N] [--from <frame>] [--to <frame>] (--png <prefix> | --gif <file>) <recording>\n",
+               args[0]);
+        return 1;
+    }
+
+    RecordingReader reader;
+    std::string error;
+    if (!reader.open(recording, &error)) {
+        printf("Could not read recording: %s\n", error.c_str());
+        return 1;
+    }
+    if (!reader.wasClosed()) {
+        printf("%s was not closed, exporting the %zu complete records\n", recording, reader.size());
+    }
+
+    RecordedFrame frame;
+    Image image;
+    std::vector<unsigned char> out;
+    size_t exported = 0;
+    size_t index = reader.find(from);
+
+    if (pngPrefix != nullptr) {
+        for (; index < reader.size(); ++index) {
+            if (!reader.read(index, frame)) {
+                printf("Record %zu is corrupt\n", index);
+                return 1;
+            }
+            if (frame.number > to) {
+                break;
+            }
+            render(frame, scale, image);
+            encodePng(image, out);
+            char name[32];
+            snprintf(name, sizeof(name), "%06llu.png", (unsigned long long) frame.number);
+            std::string path = std::string(pngPrefix) + name;
+            if (!writeFile(path, out)) {
+                printf("Could not write %s\n", path.c_str());
+                return 1;
+            }
+            ++exported;
+        }
+    } else {
+        // Each GIF frame shows the newest screen at its step, held until the screen changes
+        GifWriter gif(Chip8::MAX_WIDTH * scale, Chip8::MAX_HEIGHT * scale);
+        uint64_t first = 0;
+        uint64_t shownAt = 0;
+        bool pending = false;
+        for (; index < reader.size(); ++index) {
+            if (!reader.read(index, frame)) {
+                printf("Record %zu is corrupt\n", index);
+                return 1;
+            }
+            if (frame.number > to) {
+                break;
+            }
+            if (!pending) {
+                first = frame.number;
+            }
+            uint64_t at = centiseconds(first, frame.number) / GIF_STEP * GIF_STEP;
+            if (pending && at > shownAt) {
+                gif.add(image, at - shownAt);
+            }
+            if (!pending || at > shownAt) {
+                shownAt = at;
+            }
+            render(frame, scale, image);
+            pending = true;
+        }
+        if (pending) {
+            gif.add(image, GIF_STEP);
+        }
+        exported = gif.getFrameCount();
+        if (!writeFile(gifPath, gif.finish())) {
+            printf("Could not write %s\n", gifPath);
+            return 1;
+        }
+    }
+
+    printf("Exported %zu frames\n", exported);
+    return 0;
+}
@@ -0,0 +1,388 @@
+#include "chip8_jit.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_NATIVE 1
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+const unsigned int CODE_SIZE = 1 << 20;         // Executable buffer size in bytes
+const unsigned int MAX_BLOCK_LENGTH = 64;       // Instructions per translated block
+const unsigned int MAX_BLOCK_BYTES = 4096;      // Worst case native size of one block
+
+#ifdef CHIP8_JIT_NATIVE
+
+// x86-64 register numbers
+enum Reg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// Condition codes for setcc/cmovcc
+enum Cond {
+    COND_B = 0x2, COND_AE = 0x3, COND_E = 0x4, COND_NE = 0x5
+};
+
+// ALU opcodes for the "op r/m32, r32" form
+enum AluOp {
+    ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39
+};
+
+// ModRM reg field extensions for the immediate and shift forms
+enum Ext {
+    EXT_ADD = 0, EXT_AND = 4, EXT_CMP = 7, EXT_SHL = 4, EXT_SHR = 5
+};
+
+// Host registers V registers can live in for the duration of a block.
+// rdi holds V, rsi holds &I, r8 holds I, rax/rcx/rdx are scratch.
+const Reg V_HOST_REGS[] = { RBX, RBP, R12, R13, R14, R15, R9, R10, R11 };
+const Reg CALLEE_SAVED[] = { RBX, RBP, R12, R13, R14, R15 };
+
+// Minimal x86-64 machine code writer, 32-bit operand size unless noted
+class Emitter {
+public:
+    explicit Emitter(unsigned char* out) : out(out), start(out) {}
+
+    unsigned int size() const { return out - start; }
+
+    void movRR(int dst, int src) { rex(src, dst, false); emit(0x89); modrm(src, dst); }
+    void movRI(int dst, unsigned int imm) { rex(0, dst, false); emit(0xB8 + (dst & 7)); imm32(imm); }
+    void aluRR(AluOp op, int dst, int src) { rex(src, dst, false); emit(op); modrm(src, dst); }
+    void aluRI(Ext ext, int dst, unsigned int imm) { rex(0, dst, false); emit(0x81); modrm(ext, dst); imm32(imm); }
+    void shift1(Ext ext, int dst) { rex(0, dst, false); emit(0xD1); modrm(ext, dst); }
+    void shiftRI(Ext ext, int dst, unsigned char imm) { rex(0, dst, false); emit(0xC1); modrm(ext, dst); emit(imm); }
+    void movzx8(int dst, int src) { rex(dst, src, isLegacyByte(src)); emit(0x0F); emit(0xB6); modrm(dst, src); }
+    void setcc(Cond cc, int dst) { rex(0, dst, isLegacyByte(dst)); emit(0x0F); emit(0x90 + cc); modrm(0, dst); }
+    void cmovcc(Cond cc, int dst, int src) { rex(dst, src, false); emit(0x0F); emit(0x40 + cc); modrm(dst, src); }
+    void imulRRI(int dst, int src, unsigned char imm) { rex(dst, src, false); emit(0x6B); modrm(dst, src); emit(imm); }
+
+    // movzx dst, byte [base + disp]
+    void load8(int dst, int base, unsigned char disp) { rex(dst, base, false); emit(0x0F); emit(0xB6); mem(dst, base, disp); }
+    // movzx dst, word [base + disp]
+    void load16(int dst, int base, unsigned char disp) { rex(dst, base, false); emit(0x0F); emit(0xB7); mem(dst, base, disp); }
+    // mov byte [base + disp], src
+    void store8(int base, unsigned char disp, int src) { rex(src, base, isLegacyByte(src)); emit(0x88); mem(src, base, disp); }
+    // mov word [base + disp], src
+    void store16(int base, unsigned char disp, int src) { emit(0x66); rex(src, base, false); emit(0x89); mem(src, base, disp); }
+
+    void push(int reg) { if (reg & 8) emit(0x41); emit(0x50 + (reg & 7)); }
+    void pop(int reg) { if (reg & 8) emit(0x41); emit(0x58 + (reg & 7)); }
+    void ret() { emit(0xC3); }
+
+private:
+    // spl/bpl/sil/dil need a REX prefix to be addressed as byte registers
+    static bool isLegacyByte(int reg) { return reg >= 4 && reg < 8; }
+
+    void emit(unsigned char b) { *out++ = b; }
+
+    void imm32(unsigned int imm) {
+        for (int it = 0; it < 4; ++it) {
+            emit((imm >> (it * 8)) & 0xFF);
+        }
+    }
+
+    void rex(int reg, int rm, bool force) {
+        unsigned char prefix = 0x40 | ((reg & 8) ? 0x4 : 0) | ((rm & 8) ? 0x1 : 0);
+        if (prefix != 0x40 || force) {
+            emit(prefix);
+        }
+    }
+
+    void modrm(int reg, int rm) { emit(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+    // [base + disp8], base is never rsp/r12 so no SIB byte is needed
+    void mem(int reg, int base, unsigned char disp) { emit(0x40 | ((reg & 7) << 3) | (base & 7)); emit(disp); }
+
+    unsigned char* out;
+    unsigned char* start;
+};
+
+#endif
+
+}
+
+Chip8Jit::Chip8Jit(Chip8& chip8) : chip8(chip8), code(nullptr), codeUsed(0), generation(chip8.codeGeneration) {
+#ifdef CHIP8_JIT_NATIVE
+    void* buffer = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED) {
+        code = static_cast<unsigned char*>(buffer);
+    }
+#endif
+    flush();
+}
+
+Chip8Jit::~Chip8Jit() {
+#ifdef CHIP8_JIT_NATIVE
+    if (code != nullptr) {
+        munmap(code, CODE_SIZE);
+    }
+#endif
+}
+
+bool Chip8Jit::available() const {
+    return code != nullptr;
+}
+
+void Chip8Jit::flush() {
+    for (int i = 0; i < 4096; ++i) {
+        blocks[i].code = nullptr;
+        blocks[i].length = 0;
+        blocks[i].lastOpcode = 0;
+        blocks[i].translated = false;
+    }
+    codeUsed = 0;
+    generation = chip8.codeGeneration;
+}
+
+unsigned int Chip8Jit::step() {
+    // The program wrote over code we may have translated
+    if (generation != chip8.codeGeneration) {
+        flush();
+    }
+
+    // Blocks cover the 4K every platform but XO-CHIP has, code above it is interpreted
+    if (chip8.pc > 0x0FFF) {
+        chip8.emulateCycle();
+        return 1;
+    }
+
+    Block& block = blocks[chip8.pc];
+    if (!block.translated) {
+        block = translate(chip8.pc);
+    }
+
+    if (block.code == nullptr) {
+        chip8.emulateCycle();
+        return 1;
+    }
+
+    chip8.pc = block.code(chip8.V, &chip8.I);
+    chip8.opcode = block.lastOpcode;
+    return block.length;
+}
+
+Chip8Jit::Block Chip8Jit::translate(unsigned short address) {
+    Block block = { nullptr, 0, 0, true };
+
+#ifdef CHIP8_JIT_NATIVE
+    typedef Chip8::Instruction Instruction;
+
+    if (code == nullptr) {
+        return block;
+    }
+    if (codeUsed + MAX_BLOCK_BYTES > CODE_SIZE) {
+        flush();
+    }
+
+    // The handlers of the quirks profile the Chip8 decodes for, and what they do
+    const Chip8::QuirkHandlers& q = Chip8::QUIRK_HANDLERS[chip8.quirks];
+    const Chip8::QuirkSpec& quirks = Chip8::QUIRK_SPECS[chip8.quirks];
+
+    // Collect the block: translatable instructions up to and including the first jump or skip.
+    // Decoded apart from the cache, whose entries may hold superinstructions.
+    Instruction decoded[MAX_BLOCK_LENGTH];
+    const Instruction* instructions[MAX_BLOCK_LENGTH];
+    unsigned int length = 0;
+    bool terminated = false;
+    for (unsigned int pc = address; pc <= 0x0FFE && length < MAX_BLOCK_LENGTH && !terminated; pc += 2) {
+        Instruction& in = decoded[length];
+        chip8.decode(pc, in, false);
+
+        Chip8::Handler h = in.handler;
+        bool straight = h == &Chip8::op6XNN || h == &Chip8::op7XNN || h == &Chip8::op8XY0 ||
+                        h == q.op8XY1 || h == q.op8XY2 || h == q.op8XY3 ||
+                        h == &Chip8::op8XY4 || h == &Chip8::op8XY5 || h == q.op8XY6 ||
+                        h == &Chip8::op8XY7 || h == q.op8XYE || h == &Chip8::opANNN ||
+                        h == &Chip8::opFX1E || h == &Chip8::opFX29;
+        terminated = h == &Chip8::op1NNN || h == &Chip8::op3XNN || h == &Chip8::op4XNN ||
+                     h == &Chip8::op5XY0 || h == &Chip8::op9XY0;
+        if (!straight && !terminated) {
+            break;
+        }
+        instructions[length++] = &in;
+
+        // Keep the decode in the shared cache as well, so a store over it bumps codeGeneration
+        // and drops this block, even if the interpreter never ran the instruction
+        Instruction& cached = chip8.decoded[pc];
+        if (cached.handler == nullptr) {
+            cached = in;
+        }
+    }
+
+    if (length == 0) {
+        return block;
+    }
+
+    // Give the V registers the block touches a host register each, first come first served
+    int host[16];
+    bool dirty[16];
+    unsigned int hostUsed = 0;
+    for (int i = 0; i < 16; ++i) {
+        host[i] = -1;
+        dirty[i] = false;
+    }
+    auto use = [&](unsigned int reg) {
+        if (host[reg] < 0 && hostUsed < sizeof(V_HOST_REGS) / sizeof(V_HOST_REGS[0])) {
+            host[reg] = V_HOST_REGS[hostUsed++];
+        }
+    };
+    for (unsigned int i = 0; i < length; ++i) {
+        const Instruction& in = *instructions[i];
+        Chip8::Handler h = in.handler;
+        if (h == &Chip8::opANNN || h == &Chip8::op1NNN) {
+            continue;
+        }
+        use(in.x);
+        if (h == &Chip8::op5XY0 || h == &Chip8::op9XY0 || ((in.opcode & 0xF000) == 0x8000)) {
+            use(in.y);
+        }
+    }
+
+    Emitter e(code + codeUsed);
+
+    auto loadV = [&](int dst, unsigned int reg) {
+        if (host[reg] >= 0) {
+            e.movRR(dst, host[reg]);
+        } else {
+            e.load8(dst, RDI, reg);
+        }
+    };
+    auto storeV = [&](unsigned int reg, int src) {
+        if (host[reg] >= 0) {
+            e.movRR(host[reg], src);
+            dirty[reg] = true;
+        } else {
+            e.store8(RDI, reg, src);
+        }
+    };
+
+    // Prologue: save callee-saved registers, load the cached V registers and I
+    for (Reg reg : CALLEE_SAVED) {
+        e.push(reg);
+    }
+    for (unsigned int reg = 0; reg < 16; ++reg) {
+        if (host[reg] >= 0) {
+            e.load8(host[reg], RDI, reg);
+        }
+    }
+    e.load16(R8, RSI, 0);
+
+    // Body. The last instruction leaves the next pc in eax
+    unsigned int pc = address;
+    bool exitSet = false;
+    for (unsigned int i = 0; i < length; ++i, pc += 2) {
+        const Instruction& in = *instructions[i];
+        Chip8::Handler h = in.handler;
+
+        if (h == &Chip8::op6XNN) {
+            e.movRI(RAX, in.nn);
+            storeV(in.x, RAX);
+        } else if (h == &Chip8::op7XNN) {
+            loadV(RAX, in.x);
+            e.aluRI(EXT_ADD, RAX, in.nn);
+            e.movzx8(RAX, RAX);
+            storeV(in.x, RAX);
+        } else if (h == &Chip8::op8XY0) {
+            loadV(RAX, in.y);
+            storeV(in.x, RAX);
+        } else if (h == q.op8XY1 || h == q.op8XY2 || h == q.op8XY3) {
+            AluOp op = h == q.op8XY1 ? ALU_OR : (h == q.op8XY2 ? ALU_AND : ALU_XOR);
+            loadV(RAX, in.x);
+            loadV(RCX, in.y);
+            e.aluRR(op, RAX, RCX);
+            storeV(in.x, RAX);
+            if (quirks.vfReset) {
+                e.aluRR(ALU_XOR, RDX, RDX);
+                storeV(0xF, RDX);
+            }
+        } else if (h == &Chip8::op8XY4) {
+            loadV(RAX, in.x);
+            loadV(RCX, in.y);
+            e.aluRR(ALU_ADD, RAX, RCX);
+            e.movRR(RDX, RAX);
+            e.shiftRI(EXT_SHR, RDX, 8);     // Carry is bit 8 of the 9-bit sum
+            e.movzx8(RAX, RAX);
+            storeV(in.x, RAX);
+            storeV(0xF, RDX);
+        } else if (h == &Chip8::op8XY5 || h == &Chip8::op8XY7) {
+            // VF is 1 when there's no borrow
+            bool reverse = h == &Chip8::op8XY7;
+            loadV(RAX, reverse ? in.y : in.x);
+            loadV(RCX, reverse ? in.x : in.y);
+            e.aluRR(ALU_XOR, RDX, RDX);
+            e.aluRR(ALU_CMP, RAX, RCX);
+            e.setcc(COND_AE, RDX);
+            e.aluRR(ALU_SUB, RAX, RCX);
+            e.movzx8(RAX, RAX);
+            storeV(in.x, RAX);
+            storeV(0xF, RDX);
+        } else if (h == q.op8XY6) {
+            loadV(RAX, quirks.shiftVy ? in.y : in.x);
+            e.movRR(RDX, RAX);
+            e.aluRI(EXT_AND, RDX, 0x1);
+            e.shift1(EXT_SHR, RAX);
+            storeV(in.x, RAX);
+            storeV(0xF, RDX);
+        } else if (h == q.op8XYE) {
+            loadV(RAX, quirks.shiftVy ? in.y : in.x);
+            e.movRR(RDX, RAX);
+            e.shiftRI(EXT_SHR, RDX, 7);
+            e.shift1(EXT_SHL, RAX);
+            e.movzx8(RAX, RAX);
+            storeV(in.x, RAX);
+            storeV(0xF, RDX);
+        } else if (h == &Chip8::opANNN) {
+            e.movRI(R8, in.nnn);
+        } else if (h == &Chip8::opFX1E) {
+            loadV(RAX, in.x);
+            e.aluRR(ALU_ADD, R8, RAX);
+            e.aluRI(EXT_AND, R8, chip8.addressMask);
+        } else if (h == &Chip8::opFX29) {
+            loadV(RAX, in.x);
+            e.imulRRI(R8, RAX, 5);
+        } else if (h == &Chip8::op1NNN) {
+            e.movRI(RAX, in.nnn);
+            exitSet = true;
+        } else {
+            // Skips: next pc is pc + 4 when the condition holds, pc + 2 otherwise
+            loadV(RCX, in.x);
+            if (h == &Chip8::op3XNN || h == &Chip8::op4XNN) {
+                e.movRI(RDX, in.nn);
+            } else {
+                loadV(RDX, in.y);
+            }
+            e.aluRR(ALU_CMP, RCX, RDX);
+            e.movRI(RAX, pc + 2);
+            e.movRI(RDX, pc + 4);
+            bool equal = h == &Chip8::op3XNN || h == &Chip8::op5XY0;
+            e.cmovcc(equal ? COND_E : COND_NE, RAX, RDX);
+            exitSet = true;
+        }
+    }
+    if (!exitSet) {
+        e.movRI(RAX, pc);
+    }
+
+    // Epilogue: write back the modified V registers and I
+    for (unsigned int reg = 0; reg < 16; ++reg) {
+        if (dirty[reg]) {
+            e.store8(RDI, reg, host[reg]);
+        }
+    }
+    e.store16(RSI, 0, R8);
+    for (int i = sizeof(CALLEE_SAVED) / sizeof(CALLEE_SAVED[0]) - 1; i >= 0; --i) {
+        e.pop(CALLEE_SAVED[i]);
+    }
+    e.ret();
+
+    block.code = reinterpret_cast<BlockCode>(code + codeUsed);
+    block.length = length;
+    block.lastOpcode = instructions[length - 1]->opcode;
+    codeUsed += e.size();
+#else
+    (void) address;
+#endif
+
+    return block;
+}
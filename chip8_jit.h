@@ -0,0 +1,52 @@
+#ifndef CHIP8_CHIP8_JIT_H
+#define CHIP8_CHIP8_JIT_H
+
+#include "chip8.h"
+
+// Basic-block JIT execution engine for a Chip8, next to the emulateCycle() interpreter.
+// Straight-line register/ALU code up to the next jump or skip is translated into native
+// x86-64 code, with the touched V registers and I held in host registers for the block.
+// Everything else (calls, returns, draws, timers, keys, memory writes) is handed back to
+// the interpreter, and all translations are dropped when the program overwrites code.
+// On other hosts, and for XO-CHIP code above 4K, every step falls back to the interpreter.
+class Chip8Jit {
+public:
+    // Attaches the engine to an initialized Chip8
+    explicit Chip8Jit(Chip8& chip8);
+    ~Chip8Jit();
+
+    Chip8Jit(const Chip8Jit&) = delete;
+    Chip8Jit& operator=(const Chip8Jit&) = delete;
+
+    // Executes the translated block at pc, or one interpreted cycle if there is none.
+    // Returns the number of emulated instructions.
+    unsigned int step();
+
+    // Returns true if native translation is available on this host
+    bool available() const;
+
+    // Drops all translated blocks
+    void flush();
+
+private:
+    // Translated block entry point: takes V and &I, returns the next pc
+    typedef unsigned int (*BlockCode)(unsigned char* V, unsigned short* I);
+
+    struct Block {
+        BlockCode code;             // Nullptr if the block at this pc is interpreted
+        unsigned short length;      // Number of emulated instructions in the block
+        unsigned short lastOpcode;  // Opcode of the last one, left in Chip8::opcode as the interpreter does
+        bool translated;            // Set once the pc has been looked at
+    };
+
+    // Translates the block starting at address
+    Block translate(unsigned short address);
+
+    Chip8& chip8;
+    Block blocks[4096];             // Translations indexed by start pc
+    unsigned char* code;            // Executable code buffer
+    unsigned int codeUsed;          // Bytes of the code buffer in use
+    unsigned int generation;        // Chip8::codeGeneration the blocks were translated for
+};
+
+#endif //CHIP8_CHIP8_JIT_H
@@ -0,0 +1,359 @@
+#include "audio.h"
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "chip8_threaded.h"
+#include "frame_recorder.h"
+#include "profiler.h"
+#include "replay.h"
+#include "rom_cache.h"
+#include "scheduler.h"
+#include "trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Headless runner: loads a ROM and emulates a fixed number of cycles without
+// touching SDL or a display. Runs uncapped unless --realtime is given.
+// --record writes an input log of the run, --replay re-runs a log against the ROM and
+// checks the framebuffer after every frame. --platform runs SUPER-CHIP or XO-CHIP programs,
+// --quirks a program written for other quirks than its platform's.
+// --no-idle-skip executes idle loops instead of skipping them, --no-fusion runs superinstructions
+// as single instructions; the hit rate of each superinstruction is printed at the end. --threaded runs the table-dispatched
+// engine, and --compare runs the interpreter, executing idle loops, next to it, the JIT or the
+// interpreter skipping idle loops, and stops at the first frame where the two machine states differ. --capture writes every drawn screen to a recording for chip8-export,
+// --wav the sound as it would play, frame by frame.
+static void printUsage(const char* name) {
+    printf("Usage: %s [--jit | --threaded] [--compare] [--realtime] [--no-idle-skip] [--no-fusion]\n"
+           "       [--ipf <instructions per frame>] [--seed <seed>] [--trace <file>] [--profile <prefix>]\n"
+           "       [--platform chip8|schip|xochip] [--quirks cosmac|modern|schip|xochip]\n"
+           "       [--capture <recording>] [--wav <file>]\n"
+           "       [--record <log> | --replay <log>] <rom> [cycles]\n", name);
+}
+
+// Runs the --compare interpreter through the frame chip8 just ran. Returns false, saying where,
+// if their states differ after it. A JIT frame that ran past its budget is ahead of the
+// interpreter, so the states are only compared after frames that ended on it.
+static bool matchesReference(Chip8& chip8, const Scheduler& scheduler, Chip8& reference,
+                             Scheduler& referenceScheduler, std::vector<unsigned char>& state,
+                             std::vector<unsigned char>& referenceState) {
+    reference.setKeys();
+    referenceScheduler.runFrame();
+    if (scheduler.getOverrun() != 0) {
+        return true;
+    }
+    chip8.saveState(state);
+    reference.saveState(referenceState);
+    if (state != referenceState) {
+        size_t offset = 0;
+        while (state[offset] == referenceState[offset]) {
+            ++offset;
+        }
+        printf("Engine diverged from the interpreter at frame %llu, state byte %zu\n",
+               referenceScheduler.getFrameCount() - 1, offset);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* args[]) {
+    bool useJit = false;
+    bool useThreaded = false;
+    bool compare = false;
+    bool realtime = false;
+    bool idleSkip = true;
+    bool fusion = true;
+    unsigned int instructionsPerFrame = 10;
+    const char* rom = nullptr;
+    const char* tracePath = nullptr;
+    const char* profilePrefix = nullptr;
+    const char* recordPath = nullptr;
+    const char* replayPath = nullptr;
+    const char* capturePath = nullptr;
+    const char* wavPath = nullptr;
+    uint32_t seed = 0;
+    Chip8::Platform platform = Chip8::PLATFORM_CHIP8;
+    Chip8::Quirks quirks = Chip8::QUIRKS_MODERN;
+    bool quirksGiven = false;
+    unsigned long long cycles = 1000000;
+
+    for (int argi = 1; argi < argc; ++argi) {
+        if (std::strcmp(args[argi], "--jit") == 0) {
+            useJit = true;
+        } else if (std::strcmp(args[argi], "--threaded") == 0) {
+            useThreaded = true;
+        } else if (std::strcmp(args[argi], "--compare") == 0) {
+            compare = true;
+        } else if (std::strcmp(args[argi], "--realtime") == 0) {
+            realtime = true;
+        } else if (std::strcmp(args[argi], "--no-idle-skip") == 0) {
+            idleSkip = false;
+        } else if (std::strcmp(args[argi], "--no-fusion") == 0) {
+            fusion = false;
+        } else if (std::strcmp(args[argi], "--ipf") == 0 && argi + 1 < argc) {
+            instructionsPerFrame = std::strtoul(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--trace") == 0 && argi + 1 < argc) {
+            tracePath = args[++argi];
+        } else if (std::strcmp(args[argi], "--profile") == 0 && argi + 1 < argc) {
+            profilePrefix = args[++argi];
+        } else if (std::strcmp(args[argi], "--seed") == 0 && argi + 1 < argc) {
+            seed = std::strtoul(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--platform") == 0 && argi + 1 < argc) {
+            if (!Chip8::parsePlatform(args[++argi], platform)) {
+                printf("Unknown platform: %s\n", args[argi]);
+                return 1;
+            }
+        } else if (std::strcmp(args[argi], "--quirks") == 0 && argi + 1 < argc) {
+            if (!Chip8::parseQuirks(args[++argi], quirks)) {
+                printf("Unknown quirks: %s\n", args[argi]);
+                return 1;
+            }
+            quirksGiven = true;
+        } else if (std::strcmp(args[argi], "--record") == 0 && argi + 1 < argc) {
+            recordPath = args[++argi];
+        } else if (std::strcmp(args[argi], "--replay") == 0 && argi + 1 < argc) {
+            replayPath = args[++argi];
+        } else if (std::strcmp(args[argi], "--capture") == 0 && argi + 1 < argc) {
+            capturePath = args[++argi];
+        } else if (std::strcmp(args[argi], "--wav") == 0 && argi + 1 < argc) {
+            wavPath = args[++argi];
+        } else if (rom == nullptr) {
+            rom = args[argi];
+        } else {
+            cycles = std::strtoull(args[argi], nullptr, 10);
+        }
+    }
+
+    if (rom == nullptr || instructionsPerFrame == 0 || (recordPath != nullptr && replayPath != nullptr) ||
+        (useJit && useThreaded)) {
+        printUsage(args[0]);
+        return 1;
+    }
+
+    std::string error;
+    std::shared_ptr<const RomImage> image = RomCache::instance().load(rom, &error);
+    if (image == nullptr) {
+        printf("Program loading failed! %s\n", error.c_str());
+        return 1;
+    }
+
+    if (!quirksGiven) {
+        quirks = Chip8::defaultQuirks(platform);
+    }
+
+    // A replay runs with the seed, platform, quirks and frame budget of the log, frame for frame
+    InputLog log;
+    if (replayPath != nullptr) {
+        if (!log.load(replayPath, &error)) {
+            printf("Replay loading failed! %s\n", error.c_str());
+            return 1;
+        }
+        if (log.getRomHash() != image->hash()) {
+            printf("%s was not recorded with %s\n", replayPath, rom);
+            return 1;
+        }
+        seed = log.getSeed();
+        platform = log.getPlatform();
+        quirks = log.getQuirks();
+        instructionsPerFrame = log.getInstructionsPerFrame();
+        realtime = false;
+    } else if (recordPath != nullptr) {
+        log.begin(image->hash(), seed, instructionsPerFrame, platform, quirks);
+    }
+
+    Chip8 chip8;
+    chip8.initialize(seed, platform, quirks);
+    chip8.setIdleLoopSkipping(idleSkip);
+    chip8.setFusion(fusion);
+    if (!chip8.loadProgram(*image)) {
+        printf("Program loading failed! %s doesn't fit in %s memory\n", rom, Chip8::platformName(platform));
+        return 1;
+    }
+
+    TraceWriter trace;
+    if (tracePath != nullptr) {
+        if (!trace.open(tracePath)) {
+            printf("Could not create trace %s\n", tracePath);
+            return 1;
+        }
+        chip8.setTrace(trace.getRing());
+    }
+
+    FrameRecorder capture;
+    if (capturePath != nullptr && !capture.open(capturePath)) {
+        printf("Could not create recording %s\n", capturePath);
+        return 1;
+    }
+    // Uncapped runs outpace the encoder, keep every screen rather than the emulator's pace
+    capture.setWaitWhenFull(true);
+
+    // Each frame's samples are synthesized right after it, so the WAV keeps to emulated time
+    ToneRing toneRing;
+    ToneSynth synth(toneRing, AUDIO_SAMPLE_RATE);
+    WavWriter wav;
+    std::vector<int16_t> samples(AUDIO_SAMPLE_RATE / Scheduler::FRAME_RATE);
+    if (wavPath != nullptr) {
+        if (!wav.open(wavPath, AUDIO_SAMPLE_RATE)) {
+            printf("Could not create %s\n", wavPath);
+            return 1;
+        }
+        chip8.setAudio(&toneRing);
+    }
+    auto writeAudio = [&]() {
+        if (wavPath != nullptr) {
+            synth.render(samples.data(), samples.size());
+            wav.write(samples.data(), samples.size());
+        }
+    };
+
+    Profiler profiler;
+    if (profilePrefix != nullptr) {
+        chip8.setProfiler(&profiler);
+    }
+
+    Chip8Jit jit(chip8);
+    Chip8Threaded threaded(chip8);
+    Scheduler scheduler(chip8);
+    scheduler.setInstructionsPerFrame(instructionsPerFrame);
+    scheduler.setUncapped(!realtime);
+    if (useJit) {
+        scheduler.setJit(&jit);
+    } else if (useThreaded) {
+        scheduler.setThreaded(&threaded);
+    }
+
+    // Interpreter run in lockstep for --compare, fed the same keys
+    Chip8 reference;
+    reference.initialize(seed, platform, quirks);
+    reference.setIdleLoopSkipping(false);
+    reference.loadProgram(*image);
+    Scheduler referenceScheduler(reference);
+    referenceScheduler.setInstructionsPerFrame(instructionsPerFrame);
+    referenceScheduler.setUncapped(true);
+    ReplayKeyInput referencePlayer(log, referenceScheduler);
+    if (replayPath != nullptr) {
+        reference.setKeyInput(&referencePlayer);
+    }
+    std::vector<unsigned char> state;
+    std::vector<unsigned char> referenceState;
+
+    RecordingKeyInput recorder(nullptr, log);
+    ReplayKeyInput player(log, scheduler);
+    if (recordPath != nullptr) {
+        chip8.setKeyInput(&recorder);
+    } else if (replayPath != nullptr) {
+        chip8.setKeyInput(&player);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long executed = 0;
+    if (replayPath != nullptr) {
+        for (uint64_t frame = 0; frame < log.getFrameCount(); ++frame) {
+            chip8.setKeys();
+            executed += scheduler.runFrame();
+            if (compare && !matchesReference(chip8, scheduler, reference, referenceScheduler, state, referenceState)) {
+                return 2;
+            }
+            capture.record(chip8, scheduler.getFrameCount());
+            chip8.clearDrawFlag();
+            writeAudio();
+            if (InputLog::hashFramebuffer(chip8) != log.getFrameHash(frame)) {
+                printf("Replay diverged at frame %llu\n", (unsigned long long) frame);
+                return 2;
+            }
+        }
+    } else {
+        while (executed < cycles) {
+            chip8.setKeys();
+            executed += scheduler.runFrame();
+            if (compare && !matchesReference(chip8, scheduler, reference, referenceScheduler, state, referenceState)) {
+                return 2;
+            }
+            if (recordPath != nullptr) {
+                log.recordFrame(chip8);
+            }
+            capture.record(chip8, scheduler.getFrameCount());
+            chip8.clearDrawFlag();
+            writeAudio();
+            if (chip8.isExited()) {
+                printf("Program exited with 00FD\n");
+                break;
+            }
+            if (chip8.getFault() != Chip8::FAULT_NONE) {
+                printf("Program stopped by a fault: %s\n", Chip8::faultName(chip8.getFault()));
+                break;
+            }
+            if (chip8.isIdle()) {
+                // Nothing presses keys here, so the program would wait forever
+                printf("Halted in Fx0A waiting for a key\n");
+                break;
+            }
+            scheduler.waitForNextFrame();
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    chip8.setTrace(nullptr);
+    trace.close();
+    if (capturePath != nullptr) {
+        if (!capture.close()) {
+            printf("Could not write recording %s\n", capturePath);
+            return 1;
+        }
+        printf("Captured %llu screens (%llu dropped) in %llu bytes\n", (unsigned long long) capture.getRecordedCount(),
+               (unsigned long long) capture.getDroppedCount(), (unsigned long long) capture.getBytesWritten());
+    }
+
+    if (wavPath != nullptr && !wav.close()) {
+        printf("Could not write %s\n", wavPath);
+        return 1;
+    }
+
+    // <prefix>.json with the counters, <prefix>.folded with the call stacks
+    if (profilePrefix != nullptr) {
+        chip8.setProfiler(nullptr);
+        std::string prefix = profilePrefix;
+        FILE* json = fopen((prefix + ".json").c_str(), "w");
+        FILE* folded = fopen((prefix + ".folded").c_str(), "w");
+        if (json == nullptr || folded == nullptr) {
+            printf("Could not write profile %s.*\n", profilePrefix);
+        } else {
+            profiler.writeJson(json);
+            profiler.writeFolded(folded);
+        }
+        if (json != nullptr) {
+            fclose(json);
+        }
+        if (folded != nullptr) {
+            fclose(folded);
+        }
+    }
+
+    if (recordPath != nullptr && !log.save(recordPath)) {
+        printf("Could not write input log %s\n", recordPath);
+        return 1;
+    }
+    if (replayPath != nullptr) {
+        printf("Replay verified: %llu frames match\n", (unsigned long long) log.getFrameCount());
+    }
+
+    printf("\n%llu cycles (%llu skipped in idle loops), %llu frames in %.3f s\n", executed,
+           (unsigned long long) chip8.getIdleSkippedCount(), scheduler.getFrameCount(), elapsed);
+
+    // How often each superinstruction ran both halves in one dispatch
+    uint64_t saved = 0;
+    for (int i = 0; i < Chip8::FUSION_COUNT; ++i) {
+        Chip8::Fusion fusion = static_cast<Chip8::Fusion>(i);
+        uint64_t dispatches = chip8.getFusionDispatchCount(fusion);
+        uint64_t hits = chip8.getFusionHitCount(fusion);
+        if (dispatches > 0) {
+            printf("%-10s %12llu dispatches, %12llu fused (%5.1f%%)\n", Chip8::fusionName(fusion),
+                   (unsigned long long) dispatches, (unsigned long long) hits, 100.0 * hits / dispatches);
+        }
+        saved += hits;
+    }
+    if (saved > 0) {
+        printf("%llu dispatches saved, %.1f%% of the cycles run\n", (unsigned long long) saved,
+               100.0 * saved / (executed - chip8.getIdleSkippedCount()));
+    }
+    return 0;
+}
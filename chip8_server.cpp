@@ -0,0 +1,296 @@
+#include "rom_cache.h"
+#include "session_host.h"
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Emulation server: hosts many Chip8 sessions in one process (see SessionHost) and serves them
+// over a Unix domain socket.
+//
+// Every request and response is a u32 length of the rest, then a u8 code, then the payload,
+// all little-endian. Response code 0 is success, 1 is an error with a message as the payload.
+//   1 CREATE   u8 platform, u32 seed, u32 instructions per frame (0 for 10, at most 10000),
+//              ROM path -> u32 session id
+//   2 KEYS     u32 session, u16 keys, bit n for key n -> nothing
+//   3 FRAME    u32 session -> u64 frame number, u16 width, u16 height, u8 planes, then the
+//              newest screen delta coded (see delta.h) against the previous FRAME of the
+//              session, empty if nothing changed (see FrameUpdate)
+//   4 STATS    u32 session -> u64 frames, u64 late frames, u64 total and u64 max latency in ns
+//   5 DESTROY  u32 session -> nothing
+// Sessions outlive the connection that created them and can be driven from any connection.
+//
+// Usage: chip8-server [--socket <path>] [--threads N]
+
+namespace {
+
+enum Command {
+    COMMAND_CREATE = 1,
+    COMMAND_KEYS = 2,
+    COMMAND_FRAME = 3,
+    COMMAND_STATS = 4,
+    COMMAND_DESTROY = 5
+};
+
+const unsigned char STATUS_OK = 0;
+const unsigned char STATUS_ERROR = 1;
+
+// Longest request accepted, a CREATE with a long path. Longer ones close the connection.
+const size_t MAX_REQUEST_SIZE = 4096;
+
+const unsigned int DEFAULT_INSTRUCTIONS_PER_FRAME = 10;
+
+// Most instructions per frame a CREATE may ask for, which keeps one session from starving the
+// others on its worker thread. Faster than any XO-CHIP game needs.
+const unsigned int MAX_INSTRUCTIONS_PER_FRAME = 10000;
+
+std::atomic<bool> running(true);
+
+void onSignal(int) {
+    running.store(false);
+}
+
+void putU16(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void putU32(std::vector<unsigned char>& out, uint32_t value) {
+    putU16(out, value & 0xFFFF);
+    putU16(out, value >> 16);
+}
+
+void putU64(std::vector<unsigned char>& out, uint64_t value) {
+    putU32(out, value & 0xFFFFFFFF);
+    putU32(out, value >> 32);
+}
+
+uint16_t getU16(const unsigned char* in) {
+    return in[0] | (in[1] << 8);
+}
+
+uint32_t getU32(const unsigned char* in) {
+    return getU16(in) | ((uint32_t) getU16(in + 2) << 16);
+}
+
+// A client connection and the bytes of its next requests
+struct Connection {
+    int fd;
+    std::vector<unsigned char> input;
+};
+
+// Handles one request. Returns the response without its length.
+std::vector<unsigned char> handle(SessionHost& host, const unsigned char* request, size_t size) {
+    std::vector<unsigned char> response;
+    response.push_back(STATUS_OK);
+    auto fail = [&response](const std::string& message) {
+        response.assign(1, STATUS_ERROR);
+        response.insert(response.end(), message.begin(), message.end());
+        return response;
+    };
+    if (size < 1) {
+        return fail("empty request");
+    }
+
+    unsigned char command = request[0];
+    const unsigned char* payload = request + 1;
+    size_t payloadSize = size - 1;
+    if (command == COMMAND_CREATE) {
+        if (payloadSize < 9) {
+            return fail("truncated request");
+        }
+        if (payload[0] >= Chip8::PLATFORM_COUNT) {
+            return fail("unknown platform");
+        }
+        unsigned int instructionsPerFrame = getU32(payload + 5);
+        if (instructionsPerFrame > MAX_INSTRUCTIONS_PER_FRAME) {
+            return fail("too many instructions per frame");
+        }
+        std::string path(payload + 9, payload + payloadSize);
+        std::string error;
+        std::shared_ptr<const RomImage> rom = RomCache::instance().load(path, &error);
+        if (rom == nullptr) {
+            return fail(error);
+        }
+        uint32_t id = host.create(rom, static_cast<Chip8::Platform>(payload[0]), getU32(payload + 1),
+                                  instructionsPerFrame != 0 ? instructionsPerFrame : DEFAULT_INSTRUCTIONS_PER_FRAME,
+                                  &error);
+        if (id == 0) {
+            return fail(error);
+        }
+        putU32(response, id);
+        return response;
+    }
+
+    if (payloadSize < 4) {
+        return fail("truncated request");
+    }
+    uint32_t id = getU32(payload);
+    switch (command) {
+        case COMMAND_KEYS:
+            if (payloadSize < 6) {
+                return fail("truncated request");
+            }
+            if (!host.setKeys(id, getU16(payload + 4))) {
+                return fail("no such session");
+            }
+            return response;
+        case COMMAND_FRAME: {
+            FrameUpdate update;
+            if (!host.pullFrame(id, update)) {
+                return fail("no such session");
+            }
+            putU64(response, update.number);
+            putU16(response, update.width);
+            putU16(response, update.height);
+            response.push_back(update.planeCount);
+            response.insert(response.end(), update.delta.begin(), update.delta.end());
+            return response;
+        }
+        case COMMAND_STATS: {
+            SessionStats stats;
+            if (!host.getStats(id, stats)) {
+                return fail("no such session");
+            }
+            putU64(response, stats.frames);
+            putU64(response, stats.lateFrames);
+            putU64(response, stats.latencyTotalNanoseconds);
+            putU64(response, stats.latencyMaxNanoseconds);
+            return response;
+        }
+        case COMMAND_DESTROY:
+            if (!host.destroy(id)) {
+                return fail("no such session");
+            }
+            return response;
+    }
+    return fail("unknown command");
+}
+
+// Writes all of data. Returns false if the client went away.
+bool sendAll(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Reads what the client sent and answers the complete requests in it. Returns false when the
+// connection should be closed.
+bool serve(SessionHost& host, Connection& connection) {
+    unsigned char chunk[4096];
+    ssize_t count = recv(connection.fd, chunk, sizeof(chunk), 0);
+    if (count <= 0) {
+        return false;
+    }
+    connection.input.insert(connection.input.end(), chunk, chunk + count);
+
+    size_t offset = 0;
+    while (connection.input.size() - offset >= 4) {
+        uint32_t length = getU32(connection.input.data() + offset);
+        if (length > MAX_REQUEST_SIZE) {
+            return false;
+        }
+        if (connection.input.size() - offset - 4 < length) {
+            break;
+        }
+        std::vector<unsigned char> response = handle(host, connection.input.data() + offset + 4, length);
+        std::vector<unsigned char> header;
+        putU32(header, response.size());
+        if (!sendAll(connection.fd, header.data(), header.size()) ||
+            !sendAll(connection.fd, response.data(), response.size())) {
+            return false;
+        }
+        offset += 4 + length;
+    }
+    connection.input.erase(connection.input.begin(), connection.input.begin() + offset);
+    return true;
+}
+
+}
+
+int main(int argc, char* args[]) {
+    const char* socketPath = "chip8.sock";
+    unsigned int threads = std::thread::hardware_concurrency();
+    for (int argi = 1; argi < argc; ++argi) {
+        if (std::strcmp(args[argi], "--socket") == 0 && argi + 1 < argc) {
+            socketPath = args[++argi];
+        } else if (std::strcmp(args[argi], "--threads") == 0 && argi + 1 < argc) {
+            threads = std::strtoul(args[++argi], nullptr, 10);
+        } else {
+            printf("Usage: %s [--socket <path>] [--threads N]\n", args[0]);
+            return 1;
+        }
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socketPath) >= sizeof(address.sun_path)) {
+        printf("Socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    std::strcpy(address.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listener < 0 || bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        printf("Could not listen on %s\n", socketPath);
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    SessionHost host(threads);
+    printf("Serving on %s with %u threads\n", socketPath, host.getPool().getThreadCount());
+    fflush(stdout);
+
+    // One thread multiplexes all connections, the requests are cheap next to the frames
+    std::vector<Connection> connections;
+    while (running.load()) {
+        std::vector<pollfd> fds(1 + connections.size());
+        fds[0] = {listener, POLLIN, 0};
+        for (size_t i = 0; i < connections.size(); ++i) {
+            fds[1 + i] = {connections[i].fd, POLLIN, 0};
+        }
+        if (poll(fds.data(), fds.size(), 100) <= 0) {
+            continue;
+        }
+
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (fds[1 + i].revents != 0 && !serve(host, connections[i])) {
+                close(connections[i].fd);
+                connections.erase(connections.begin() + i);
+            }
+        }
+        if ((fds[0].revents & POLLIN) != 0) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client >= 0) {
+                connections.push_back({client, std::vector<unsigned char>()});
+            }
+        }
+    }
+
+    for (const Connection& connection : connections) {
+        close(connection.fd);
+    }
+    close(listener);
+    unlink(socketPath);
+    printf("%zu sessions, %llu frames run, %llu stolen by idle workers\n", host.getSessionCount(),
+           (unsigned long long) host.getPool().getCompletedCount(), (unsigned long long) host.getPool().getStolenCount());
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include "chip8_threaded.h"
+
+namespace {
+
+// Compile-time list of table indices 0..N-1, std::make_index_sequence is C++14
+template <unsigned int... I>
+struct Indices {};
+
+template <unsigned int N, unsigned int... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <unsigned int... I>
+struct MakeIndices<0, I...> {
+    typedef Indices<I...> Type;
+};
+
+}
+
+struct Chip8Threaded::Ops {
+    // Handler for the opcodes with high byte HI, on XO-CHIP if XO, with the quirks Q
+    template <unsigned int HI, bool XO, Chip8::Quirks Q>
+    static void exec(Chip8& c, unsigned int opcode);
+
+    // 8XYN handler for register X and operation N with the quirks Q, Y is read from the opcode
+    template <unsigned int X, unsigned int N, Chip8::Quirks Q>
+    static void alu(Chip8& c, unsigned int opcode);
+
+    // Executes the instruction at pc with the interpreter's handler for it
+    static void interpret(Chip8& c);
+
+    // Returns the high byte table for the platform and quirks of c
+    static const Handler* table(const Chip8& c);
+
+    // Handler tables, one entry per index in Seq
+    template <bool XO, Chip8::Quirks Q, typename Seq>
+    struct Table;
+    template <unsigned int X, Chip8::Quirks Q, typename Seq>
+    struct AluTable;
+};
+
+template <bool XO, Chip8::Quirks Q, unsigned int... HI>
+struct Chip8Threaded::Ops::Table<XO, Q, Indices<HI...>> {
+    static const Handler handlers[sizeof...(HI)];
+};
+
+template <bool XO, Chip8::Quirks Q, unsigned int... HI>
+const Chip8Threaded::Handler Chip8Threaded::Ops::Table<XO, Q, Indices<HI...>>::handlers[sizeof...(HI)] = {
+        &Ops::exec<HI, XO, Q>...
+};
+
+template <unsigned int X, Chip8::Quirks Q, unsigned int... N>
+struct Chip8Threaded::Ops::AluTable<X, Q, Indices<N...>> {
+    static const Handler handlers[sizeof...(N)];
+};
+
+template <unsigned int X, Chip8::Quirks Q, unsigned int... N>
+const Chip8Threaded::Handler Chip8Threaded::Ops::AluTable<X, Q, Indices<N...>>::handlers[sizeof...(N)] = {
+        &Ops::alu<X, N, Q>...
+};
+
+template <unsigned int HI, bool XO, Chip8::Quirks Q>
+void Chip8Threaded::Ops::exec(Chip8& c, unsigned int opcode) {
+    const unsigned int x = HI & 0xF;
+    unsigned int nn = opcode & 0xFF;
+    unsigned int y = nn >> 4;
+
+    // The family is a constant, so each instantiation keeps a single case. XO-CHIP skips
+    // may have to step over a 4-byte F000 NNNN and 5XYN has more forms there, so those are
+    // left to the interpreter's decode.
+    switch (HI >> 4) {
+        case 0x0:
+            if (HI == 0x00 && nn == 0xEE && c.sp != 0) {
+                --c.sp;
+                c.pc = c.stack[c.sp] + 2;
+                return;
+            }
+            break;
+        case 0x2:
+            if (c.sp == 16) break;
+            c.stack[c.sp] = c.pc;
+            ++c.sp;
+            c.pc = opcode & 0x0FFF;
+            return;
+        case 0x3:
+            if (XO) break;
+            c.pc += c.V[x] == nn ? 4 : 2;
+            return;
+        case 0x4:
+            if (XO) break;
+            c.pc += c.V[x] != nn ? 4 : 2;
+            return;
+        case 0x5:
+            if (XO) break;
+            c.pc += c.V[x] == c.V[y] ? 4 : 2;
+            return;
+        case 0x6:
+            c.V[x] = nn;
+            c.pc += 2;
+            return;
+        case 0x7:
+            c.V[x] += nn;
+            c.pc += 2;
+            return;
+        case 0x8:
+            AluTable<x, Q, MakeIndices<16>::Type>::handlers[opcode & 0xF](c, opcode);
+            return;
+        case 0x9:
+            if (XO) break;
+            c.pc += c.V[x] != c.V[y] ? 4 : 2;
+            return;
+        case 0xA:
+            c.I = opcode & 0x0FFF;
+            c.pc += 2;
+            return;
+        case 0xF:
+            if (nn == 0x07) {
+                c.V[x] = c.delay_timer;
+                c.pc += 2;
+                return;
+            }
+            if (nn == 0x1E) {
+                c.I = (c.I + c.V[x]) & c.addressMask;
+                c.pc += 2;
+                return;
+            }
+            break;
+    }
+    interpret(c);
+}
+
+template <unsigned int X, unsigned int N, Chip8::Quirks Q>
+void Chip8Threaded::Ops::alu(Chip8& c, unsigned int opcode) {
+    // Same results as Chip8::op8XY0..op8XYE, VF written last
+    const Chip8::QuirkSpec& quirks = Chip8::QUIRK_SPECS[Q];
+    unsigned char& vx = c.V[X];
+    unsigned char vy = c.V[(opcode >> 4) & 0xF];
+    unsigned char flag;
+    switch (N) {
+        case 0x0: vx = vy; break;
+        case 0x1: vx |= vy; if (quirks.vfReset) c.V[0xF] = 0; break;
+        case 0x2: vx &= vy; if (quirks.vfReset) c.V[0xF] = 0; break;
+        case 0x3: vx ^= vy; if (quirks.vfReset) c.V[0xF] = 0; break;
+        case 0x4:
+            flag = vy > 0xFF - vx ? 1 : 0;
+            vx += vy;
+            c.V[0xF] = flag;
+            break;
+        case 0x5:
+            flag = vy > vx ? 0 : 1;
+            vx -= vy;
+            c.V[0xF] = flag;
+            break;
+        case 0x6:
+            flag = (quirks.shiftVy ? vy : vx) & 0x1;
+            vx = (quirks.shiftVy ? vy : vx) >> 1;
+            c.V[0xF] = flag;
+            break;
+        case 0x7:
+            flag = vx > vy ? 0 : 1;
+            vx = vy - vx;
+            c.V[0xF] = flag;
+            break;
+        case 0xE:
+            flag = (quirks.shiftVy ? vy : vx) >> 7;
+            vx = (quirks.shiftVy ? vy : vx) << 1;
+            c.V[0xF] = flag;
+            break;
+        default:
+            interpret(c);
+            return;
+    }
+    c.pc += 2;
+}
+
+void Chip8Threaded::Ops::interpret(Chip8& c) {
+    Chip8::Instruction& instruction = c.decoded[c.pc & c.addressMask];
+    if (instruction.handler == nullptr) {
+        c.decode(c.pc & c.addressMask, instruction);
+    }
+    instruction.handler(c, instruction);
+}
+
+const Chip8Threaded::Handler* Chip8Threaded::Ops::table(const Chip8& c) {
+    typedef MakeIndices<256>::Type All;
+    static const Handler* const TABLES[2][Chip8::QUIRKS_COUNT] = {
+            {
+                    Table<false, Chip8::QUIRKS_COSMAC, All>::handlers,
+                    Table<false, Chip8::QUIRKS_MODERN, All>::handlers,
+                    Table<false, Chip8::QUIRKS_SCHIP, All>::handlers,
+                    Table<false, Chip8::QUIRKS_XOCHIP, All>::handlers,
+            },
+            {
+                    Table<true, Chip8::QUIRKS_COSMAC, All>::handlers,
+                    Table<true, Chip8::QUIRKS_MODERN, All>::handlers,
+                    Table<true, Chip8::QUIRKS_SCHIP, All>::handlers,
+                    Table<true, Chip8::QUIRKS_XOCHIP, All>::handlers,
+            },
+    };
+    return TABLES[c.platform == Chip8::PLATFORM_XOCHIP][c.quirks];
+}
+
+Chip8Threaded::Chip8Threaded(Chip8& chip8) : chip8(chip8) {
+}
+
+unsigned int Chip8Threaded::run(unsigned int budget) {
+    Chip8& c = chip8;
+
+    // Tracing and profiling hook into the interpreter's cycle
+    if (c.traceRing != nullptr || c.profiler != nullptr) {
+        return c.run(budget);
+    }
+
+    const Handler* table = Ops::table(c);
+
+    // Same loop as Chip8::run(): handlers cut cycleLimit to hand control back for Fx0A and idle loops
+    unsigned int executed = 0;
+    while (executed < budget && !c.waitingForKey && c.fault == Chip8::FAULT_NONE) {
+        c.cycleLimit = budget;
+        while (executed < c.cycleLimit) {
+            unsigned int address = c.pc & c.addressMask;
+            unsigned int opcode = c.memory[address] << 8 | c.memory[(address + 1) & c.addressMask];
+            c.opcode = opcode;
+            table[opcode >> 8](c, opcode);
+            ++executed;
+        }
+        executed = c.skipIdleLoop(executed, budget);
+    }
+    return executed;
+}
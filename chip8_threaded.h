@@ -0,0 +1,36 @@
+#ifndef CHIP8_CHIP8_THREADED_H
+#define CHIP8_CHIP8_THREADED_H
+
+#include "chip8.h"
+
+// Table-dispatched execution engine for a Chip8, next to the decode cache interpreter.
+// Every instruction is fetched straight from memory and dispatched on its high byte through
+// a 256-entry handler table generated at compile time, with each handler specialized on the
+// opcode family and X (8XYN on X and N through a second 16-entry table per X), and a set of
+// tables per quirks profile so the 8XYN handlers bake theirs in. There is no
+// per-address decode to keep in sync, so self-modifying code costs nothing. Register, ALU,
+// skip, call and return instructions run in the specialized handlers; the rest (jumps, draws,
+// memory, timers, keys, and the opcodes a platform decodes differently) go through the
+// interpreter's handlers.
+// Runs give the same machine state as Chip8::run() cycle for cycle.
+class Chip8Threaded {
+public:
+    // Attaches the engine to an initialized Chip8
+    explicit Chip8Threaded(Chip8& chip8);
+
+    // Emulates up to budget cycles like Chip8::run(), fewer if an Fx0A halts the CPU or
+    // a fault stops it.
+    // Returns the number of cycles emulated, counting idle loop iterations skipped.
+    unsigned int run(unsigned int budget);
+
+private:
+    // Executes the instruction opcode at pc
+    typedef void (*Handler)(Chip8& c, unsigned int opcode);
+
+    // The specialized handlers and their tables, see chip8_threaded.cpp
+    struct Ops;
+
+    Chip8& chip8;
+};
+
+#endif //CHIP8_CHIP8_THREADED_H
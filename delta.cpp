@@ -0,0 +1,94 @@
+#include "delta.h"
+#include <cstring>
+
+namespace {
+
+// Runs of unchanged bytes shorter than this are cheaper to keep inside a literal
+const size_t MIN_SKIP = 3;
+
+void putVarint(std::vector<unsigned char>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+bool getVarint(const unsigned char*& in, const unsigned char* end, size_t& value) {
+    value = 0;
+    for (unsigned int shift = 0; in < end && shift < 8 * sizeof(size_t); shift += 7) {
+        unsigned char b = *in++;
+        value |= (size_t) (b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned char referenceAt(const unsigned char* reference, size_t i) {
+    return reference != nullptr ? reference[i] : 0;
+}
+
+}
+
+void encodeDelta(const unsigned char* reference, const unsigned char* current, size_t size,
+                 std::vector<unsigned char>& out) {
+    size_t i = 0;
+    while (i < size) {
+        // Unchanged run
+        size_t skipStart = i;
+        while (i < size && current[i] == referenceAt(reference, i)) {
+            ++i;
+        }
+        size_t skip = i - skipStart;
+        if (i == size) {
+            break;
+        }
+
+        // Changed run, absorbing unchanged gaps too short to be worth a new skip
+        size_t literalStart = i;
+        size_t same = 0;
+        while (i < size && same < MIN_SKIP) {
+            same = current[i] == referenceAt(reference, i) ? same + 1 : 0;
+            ++i;
+        }
+        if (same == MIN_SKIP) {
+            i -= same;
+        }
+
+        putVarint(out, skip);
+        putVarint(out, i - literalStart);
+        for (size_t it = literalStart; it < i; ++it) {
+            out.push_back(current[it] ^ referenceAt(reference, it));
+        }
+    }
+}
+
+bool decodeDelta(const unsigned char* reference, const unsigned char* delta, size_t deltaSize,
+                 unsigned char* out, size_t size) {
+    if (reference != nullptr) {
+        std::memcpy(out, reference, size);
+    } else {
+        std::memset(out, 0, size);
+    }
+
+    const unsigned char* in = delta;
+    const unsigned char* end = delta + deltaSize;
+    size_t i = 0;
+    while (in < end) {
+        size_t skip;
+        size_t literal;
+        if (!getVarint(in, end, skip) || !getVarint(in, end, literal)) {
+            return false;
+        }
+        if (skip > size - i || literal > size - i - skip || literal > (size_t) (end - in)) {
+            return false;
+        }
+        i += skip;
+        for (size_t it = 0; it < literal; ++it) {
+            out[i++] ^= *in++;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef CHIP8_DELTA_H
+#define CHIP8_DELTA_H
+
+#include <cstddef>
+#include <vector>
+
+// XOR + run-length delta coding of fixed-size buffers (machine states, frames).
+// The XOR of two similar buffers is mostly zero, so it is stored as alternating
+// varint-prefixed runs: skip N unchanged bytes, then N literal XOR bytes, repeated.
+// A nullptr reference stands for an all-zero buffer, which makes the delta a
+// self-contained keyframe.
+
+// Appends the delta from reference to current (size bytes each) to out
+void encodeDelta(const unsigned char* reference, const unsigned char* current, size_t size,
+                 std::vector<unsigned char>& out);
+
+// Rebuilds size bytes into out from reference and a delta produced by encodeDelta().
+// Returns false if the delta is malformed or runs past size bytes.
+bool decodeDelta(const unsigned char* reference, const unsigned char* delta, size_t deltaSize,
+                 unsigned char* out, size_t size);
+
+#endif //CHIP8_DELTA_H
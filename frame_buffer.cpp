@@ -0,0 +1,56 @@
+#include "frame_buffer.h"
+#include <cstring>
+
+void Frame::capture(const Chip8& chip8, uint64_t number) {
+    width = chip8.getWidth();
+    height = chip8.getHeight();
+    planeCount = chip8.getPlaneCount();
+    this->number = number;
+    for (unsigned int plane = 0; plane < Chip8::PLANE_COUNT; ++plane) {
+        std::memcpy(rows[plane], chip8.getFramebuffer(plane), sizeof(rows[plane]));
+    }
+}
+
+uint64_t Frame::diffRows(const Frame& other) const {
+    if (width != other.width || planeCount != other.planeCount) {
+        return ~0ull;
+    }
+    uint64_t dirty = 0;
+    for (unsigned int plane = 0; plane < planeCount; ++plane) {
+        for (unsigned int row = 0; row < height; ++row) {
+            uint64_t changed = 0;
+            for (unsigned int word = 0; word < Chip8::ROW_WORDS; ++word) {
+                changed |= rows[plane][row][word] ^ other.rows[plane][row][word];
+            }
+            dirty |= (uint64_t) (changed != 0) << row;
+        }
+    }
+    return dirty;
+}
+
+void FrameBuffer::publish() {
+    // The release orders the frame contents before the index the consumer picks up
+    unsigned int previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+    backIndex = previous & ~FRESH;
+    published.fetch_add(1, std::memory_order_relaxed);
+    if ((previous & FRESH) != 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+const Frame* FrameBuffer::acquire() {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+        return nullptr;
+    }
+    unsigned int previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+    frontIndex = previous & ~FRESH;
+    return &frames[frontIndex];
+}
+
+uint64_t FrameBuffer::getPublishedCount() const {
+    return published.load(std::memory_order_relaxed);
+}
+
+uint64_t FrameBuffer::getDroppedCount() const {
+    return dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+#ifndef CHIP8_FRAME_BUFFER_H
+#define CHIP8_FRAME_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include "chip8.h"
+
+// The screen of a Chip8 at the end of an emulated frame, detached from the machine
+struct Frame {
+    unsigned int width;
+    unsigned int height;
+    unsigned int planeCount;
+    uint64_t number;                // Emulated frame it was captured after
+    uint64_t rows[Chip8::PLANE_COUNT][Chip8::MAX_HEIGHT][Chip8::ROW_WORDS];     // As Chip8::getFramebuffer()
+
+    // Copies the screen of chip8
+    void capture(const Chip8& chip8, uint64_t number);
+
+    // Returns the rows that differ from other, bit n for row n, or all rows if the resolution differs
+    uint64_t diffRows(const Frame& other) const;
+};
+
+// Lock-free triple buffer handing completed frames from the emulation thread to the render
+// thread. The producer always has a buffer to fill and the consumer always holds a complete
+// frame, so neither ever waits for the other: a slow consumer skips to the newest frame, and
+// frames published faster than they are consumed are counted as dropped.
+class FrameBuffer {
+public:
+    FrameBuffer() = default;
+
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    // Producer side. Returns the buffer to fill with the next frame.
+    Frame& back() { return frames[backIndex]; }
+
+    // Producer side. Makes back() the newest frame and switches to a free buffer.
+    void publish();
+
+    // Returns true while the newest published frame hasn't been acquired yet. A producer
+    // running ahead of the display can skip capturing frames nobody will see.
+    bool isPending() const { return (middle.load(std::memory_order_relaxed) & FRESH) != 0; }
+
+    // Consumer side. Returns the newest frame if one was published since the last call, nullptr
+    // otherwise. The frame stays valid until the next call.
+    const Frame* acquire();
+
+    // Returns the number of frames published, and of those replaced before they were acquired
+    uint64_t getPublishedCount() const;
+    uint64_t getDroppedCount() const;
+
+private:
+    // middle holds the index of the buffer between the two sides, with FRESH set while it
+    // holds a frame the consumer hasn't taken
+    static const unsigned int FRESH = 0x4;
+
+    Frame frames[3];
+    unsigned int backIndex = 0;                     // Owned by the producer
+    unsigned int frontIndex = 1;                    // Owned by the consumer
+    alignas(64) std::atomic<unsigned int> middle{2};
+    alignas(64) std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> dropped{0};
+};
+
+#endif //CHIP8_FRAME_BUFFER_H
@@ -0,0 +1,393 @@
+#include "frame_recorder.h"
+#include "chip8.h"
+#include "delta.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+const size_t HEADER_SIZE = 4 + 2 + 2 + 4;
+const size_t RECORD_HEADER_SIZE = 4 + 8 + 2 + 2 + 1;
+const size_t INDEX_ENTRY_SIZE = 8 + 8 + 8;
+const size_t TRAILER_SIZE = 8 + 8 + 4 + 4;
+
+void putU16(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void putU32(std::vector<unsigned char>& out, uint32_t value) {
+    putU16(out, value & 0xFFFF);
+    putU16(out, value >> 16);
+}
+
+void putU64(std::vector<unsigned char>& out, uint64_t value) {
+    putU32(out, value & 0xFFFFFFFF);
+    putU32(out, value >> 32);
+}
+
+uint16_t getU16(const unsigned char* in) {
+    return in[0] | (in[1] << 8);
+}
+
+uint32_t getU32(const unsigned char* in) {
+    return getU16(in) | ((uint32_t) getU16(in + 2) << 16);
+}
+
+uint64_t getU64(const unsigned char* in) {
+    return getU32(in) | ((uint64_t) getU32(in + 4) << 32);
+}
+
+bool seekTo(FILE* file, uint64_t offset) {
+    return fseek(file, (long) offset, SEEK_SET) == 0;
+}
+
+}
+
+FrameRecorder::~FrameRecorder() {
+    close();
+}
+
+bool FrameRecorder::open(const char* path, unsigned int keyframeInterval, size_t capacity) {
+    close();
+
+    file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    this->keyframeInterval = keyframeInterval != 0 ? keyframeInterval : 1;
+    failed = false;
+    bytesWritten = 0;
+    recordCount = 0;
+    sinceKeyframe = 0;
+    previousWidth = 0;
+    previousHeight = 0;
+    index.clear();
+
+    std::vector<unsigned char> header(RECORDING_MAGIC, RECORDING_MAGIC + 4);
+    putU16(header, RECORDING_VERSION);
+    putU16(header, 0);
+    putU32(header, this->keyframeInterval);
+    write(header.data(), header.size());
+
+    // Slots are sized for a hi-res screen up front, record() never allocates
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots.resize(size);
+    for (Slot& slot : slots) {
+        slot.pixels.resize(Chip8::MAX_WIDTH * Chip8::MAX_HEIGHT);
+    }
+    mask = size - 1;
+    head = 0;
+    tail = 0;
+    recorded = 0;
+    dropped = 0;
+
+    stopping = false;
+    thread = std::thread(&FrameRecorder::run, this);
+    return true;
+}
+
+void FrameRecorder::setWaitWhenFull(bool wait) {
+    waitWhenFull = wait;
+}
+
+void FrameRecorder::record(Chip8& chip8, uint64_t number) {
+    if (file == nullptr || !chip8.getDrawFlag()) {
+        return;
+    }
+    size_t h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == slots.size()) {
+        if (!waitWhenFull) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
+    Slot& slot = slots[h & mask];
+    slot.number = number;
+    slot.width = chip8.getWidth();
+    slot.height = chip8.getHeight();
+    std::memcpy(slot.pixels.data(), chip8.getGraphics(), slot.width * slot.height);
+    head.store(h + 1, std::memory_order_release);
+    recorded.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool FrameRecorder::close() {
+    if (file == nullptr) {
+        return true;
+    }
+    if (thread.joinable()) {
+        stopping = true;
+        thread.join();
+    }
+
+    // Seek index and trailer
+    uint64_t indexOffset = bytesWritten.load();
+    buffer.clear();
+    for (const IndexEntry& entry : index) {
+        putU64(buffer, entry.record);
+        putU64(buffer, entry.number);
+        putU64(buffer, entry.offset);
+    }
+    putU64(buffer, recordCount);
+    putU64(buffer, indexOffset);
+    putU32(buffer, index.size());
+    buffer.insert(buffer.end(), RECORDING_INDEX_MAGIC, RECORDING_INDEX_MAGIC + 4);
+    write(buffer.data(), buffer.size());
+
+    bool ok = fclose(file) == 0 && !failed;
+    file = nullptr;
+    slots.clear();
+    return ok;
+}
+
+uint64_t FrameRecorder::getRecordedCount() const {
+    return recorded.load(std::memory_order_relaxed);
+}
+
+uint64_t FrameRecorder::getDroppedCount() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t FrameRecorder::getBytesWritten() const {
+    return bytesWritten.load(std::memory_order_relaxed);
+}
+
+void FrameRecorder::run() {
+    for (;;) {
+        // Read the flag before draining so nothing queued before close() is lost
+        bool last = stopping.load();
+
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t available = head.load(std::memory_order_acquire) - t;
+        for (size_t i = 0; i < available; ++i) {
+            encode(slots[(t + i) & mask]);
+            tail.store(t + i + 1, std::memory_order_release);
+        }
+
+        if (available == 0) {
+            if (last) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    fflush(file);
+}
+
+void FrameRecorder::encode(const Slot& slot) {
+    size_t size = slot.width * slot.height;
+    // A resolution switch has nothing to delta against
+    bool keyframe = recordCount == 0 || sinceKeyframe + 1 >= keyframeInterval ||
+                    slot.width != previousWidth || slot.height != previousHeight;
+    if (keyframe) {
+        index.push_back({recordCount, slot.number, bytesWritten.load(std::memory_order_relaxed)});
+        sinceKeyframe = 0;
+    } else {
+        ++sinceKeyframe;
+    }
+
+    // The delta goes behind room left for the header, which needs its size
+    buffer.resize(RECORD_HEADER_SIZE);
+    encodeDelta(keyframe ? nullptr : previous.data(), slot.pixels.data(), size, buffer);
+    std::vector<unsigned char> header;
+    putU32(header, buffer.size() - RECORD_HEADER_SIZE);
+    putU64(header, slot.number);
+    putU16(header, slot.width);
+    putU16(header, slot.height);
+    header.push_back(keyframe ? RECORDING_KEYFRAME : 0);
+    std::copy(header.begin(), header.end(), buffer.begin());
+    write(buffer.data(), buffer.size());
+
+    previous.assign(slot.pixels.begin(), slot.pixels.begin() + size);
+    previousWidth = slot.width;
+    previousHeight = slot.height;
+    ++recordCount;
+}
+
+void FrameRecorder::write(const unsigned char* data, size_t size) {
+    if (fwrite(data, 1, size, file) != size) {
+        failed = true;
+    }
+    bytesWritten.fetch_add(size, std::memory_order_relaxed);
+}
+
+RecordingReader::~RecordingReader() {
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+bool RecordingReader::open(const char* path, std::string* error) {
+    if (file != nullptr) {
+        fclose(file);
+    }
+    keyframes.clear();
+    recordCount = 0;
+    hasCurrent = false;
+
+    file = fopen(path, "rb");
+    if (file == nullptr) {
+        *error = std::string("cannot open ") + path;
+        return false;
+    }
+    unsigned char header[HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        std::memcmp(header, RECORDING_MAGIC, 4) != 0) {
+        *error = std::string(path) + " is not a frame recording";
+        return false;
+    }
+    if (getU16(header + 4) != RECORDING_VERSION) {
+        *error = std::string(path) + " is from an unsupported recording version";
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    uint64_t fileSize = ftell(file);
+    closed = loadIndex(fileSize);
+    if (!closed) {
+        // Left unclosed by a crash, maybe cut off mid-record. The records before that are still good.
+        scanRecords(fileSize);
+    }
+    return true;
+}
+
+size_t RecordingReader::size() const {
+    return recordCount;
+}
+
+bool RecordingReader::wasClosed() const {
+    return closed;
+}
+
+bool RecordingReader::read(size_t index, RecordedFrame& frame) {
+    if (index >= recordCount) {
+        return false;
+    }
+    // Continue from the current record unless a keyframe closer to index comes after it
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), (uint64_t) index,
+                                 [](uint64_t i, const Keyframe& keyframe) { return i < keyframe.record; });
+    if (next == keyframes.begin()) {
+        return false;
+    }
+    const Keyframe& keyframe = *(next - 1);
+    if (!hasCurrent || currentIndex > index || currentIndex < keyframe.record) {
+        hasCurrent = false;
+        if (!seekTo(file, keyframe.offset)) {
+            return false;
+        }
+        currentIndex = keyframe.record;
+        if (!readNext()) {
+            return false;
+        }
+    }
+    while (currentIndex < index) {
+        ++currentIndex;
+        if (!readNext()) {
+            hasCurrent = false;
+            return false;
+        }
+    }
+    frame = current;
+    return true;
+}
+
+size_t RecordingReader::find(uint64_t number) {
+    // Frame numbers only grow, so start at the last keyframe before number
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), number,
+                                 [](uint64_t n, const Keyframe& keyframe) { return n < keyframe.number; });
+    size_t index = next == keyframes.begin() ? 0 : (next - 1)->record;
+    RecordedFrame frame;
+    for (; index < recordCount; ++index) {
+        if (!read(index, frame)) {
+            return recordCount;
+        }
+        if (frame.number >= number) {
+            break;
+        }
+    }
+    return index;
+}
+
+bool RecordingReader::loadIndex(uint64_t fileSize) {
+    unsigned char trailer[TRAILER_SIZE];
+    if (fileSize < HEADER_SIZE + TRAILER_SIZE || !seekTo(file, fileSize - TRAILER_SIZE) ||
+        fread(trailer, 1, sizeof(trailer), file) != sizeof(trailer) ||
+        std::memcmp(trailer + 20, RECORDING_INDEX_MAGIC, 4) != 0) {
+        return false;
+    }
+    uint64_t count = getU64(trailer);
+    uint64_t indexOffset = getU64(trailer + 8);
+    uint32_t keyframeCount = getU32(trailer + 16);
+    if (indexOffset < HEADER_SIZE || indexOffset + (uint64_t) keyframeCount * INDEX_ENTRY_SIZE + TRAILER_SIZE != fileSize) {
+        return false;
+    }
+
+    std::vector<unsigned char> in(keyframeCount * INDEX_ENTRY_SIZE);
+    if (!seekTo(file, indexOffset) || fread(in.data(), 1, in.size(), file) != in.size()) {
+        return false;
+    }
+    keyframes.resize(keyframeCount);
+    for (uint32_t i = 0; i < keyframeCount; ++i) {
+        const unsigned char* p = in.data() + i * INDEX_ENTRY_SIZE;
+        keyframes[i] = {getU64(p), getU64(p + 8), getU64(p + 16)};
+    }
+    recordCount = count;
+    return true;
+}
+
+void RecordingReader::scanRecords(uint64_t fileSize) {
+    keyframes.clear();
+    recordCount = 0;
+    uint64_t offset = HEADER_SIZE;
+    unsigned char header[RECORD_HEADER_SIZE];
+    while (offset + RECORD_HEADER_SIZE <= fileSize) {
+        if (!seekTo(file, offset) || fread(header, 1, sizeof(header), file) != sizeof(header)) {
+            break;
+        }
+        uint64_t next = offset + RECORD_HEADER_SIZE + getU32(header);
+        if (next > fileSize) {
+            break;
+        }
+        if ((header[16] & RECORDING_KEYFRAME) != 0) {
+            keyframes.push_back({recordCount, getU64(header + 4), offset});
+        }
+        ++recordCount;
+        offset = next;
+    }
+}
+
+bool RecordingReader::readNext() {
+    unsigned char header[RECORD_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        hasCurrent = false;
+        return false;
+    }
+    unsigned int width = getU16(header + 12);
+    unsigned int height = getU16(header + 14);
+    bool keyframe = (header[16] & RECORDING_KEYFRAME) != 0;
+    if (width > Chip8::MAX_WIDTH || height > Chip8::MAX_HEIGHT ||
+        (!keyframe && (!hasCurrent || width != current.width || height != current.height))) {
+        hasCurrent = false;
+        return false;
+    }
+    delta.resize(getU32(header));
+    pixels.resize(width * height);
+    if (fread(delta.data(), 1, delta.size(), file) != delta.size() ||
+        !decodeDelta(keyframe ? nullptr : current.pixels.data(), delta.data(), delta.size(), pixels.data(),
+                     pixels.size())) {
+        hasCurrent = false;
+        return false;
+    }
+    current.number = getU64(header + 4);
+    current.width = width;
+    current.height = height;
+    current.keyframe = keyframe;
+    current.pixels.swap(pixels);
+    hasCurrent = true;
+    return true;
+}
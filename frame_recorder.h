@@ -0,0 +1,172 @@
+#ifndef CHIP8_FRAME_RECORDER_H
+#define CHIP8_FRAME_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Chip8;
+
+// Recording file layout: "C8FR", u16 version, u16 reserved, u32 keyframe interval, then one
+// record per drawn frame: u32 delta size, u64 frame number, u16 width, u16 height, u8 flags,
+// then the screen as Chip8::getGraphics() bytes, delta coded (see delta.h) against the previous
+// record, or against zero for a keyframe (RECORDING_KEYFRAME). A closed recording ends with its
+// seek index: per keyframe u64 record index, u64 frame number and u64 file offset, then u64
+// record count, u64 index offset, u32 keyframe count and "C8FX", all little-endian.
+// A recording that was never closed has no index, readers rebuild it by walking the records.
+const char RECORDING_MAGIC[4] = { 'C', '8', 'F', 'R' };
+const char RECORDING_INDEX_MAGIC[4] = { 'C', '8', 'F', 'X' };
+const uint16_t RECORDING_VERSION = 1;
+const uint8_t RECORDING_KEYFRAME = 0x01;
+
+// One decoded screen of a recording
+struct RecordedFrame {
+    uint64_t number;                    // Emulated frame the screen was captured after
+    unsigned int width;                 // As Chip8::getWidth() and getHeight()
+    unsigned int height;
+    bool keyframe;
+    std::vector<unsigned char> pixels;  // width * height bytes, bit n set where plane n is lit
+};
+
+// Records the screens a Chip8 draws into a recording file. The emulation thread only copies
+// a drawn screen into a fixed ring, a background thread delta codes and writes it, so the
+// emulator never waits on the disk. Screens pushed into a full ring are counted and dropped,
+// the next record then simply carries a later frame number, unless the recorder is set to
+// wait for room, as runs faster than real time must to keep every screen.
+class FrameRecorder {
+public:
+    FrameRecorder() = default;
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    // Creates the file and starts the encoder thread. Every keyframeInterval-th record is a
+    // keyframe. Returns false if the file can't be created.
+    bool open(const char* path, unsigned int keyframeInterval = 300, size_t capacity = 64);
+
+    // Makes record() wait for the encoder instead of dropping screens when the ring is full
+    void setWaitWhenFull(bool wait);
+
+    // Queues the screen of chip8 as frame number if its draw flag is set. Leaves the flag to
+    // the caller. Call from the emulation thread after a frame.
+    void record(Chip8& chip8, uint64_t number);
+
+    // Encodes the queued screens, writes the seek index, stops the thread and closes the file.
+    // Returns false if any write failed.
+    bool close();
+
+    // Returns the number of screens queued and of screens dropped because the ring was full
+    uint64_t getRecordedCount() const;
+    uint64_t getDroppedCount() const;
+
+    // Returns the bytes written so far, header and records
+    uint64_t getBytesWritten() const;
+
+private:
+    struct Slot {
+        uint64_t number;
+        unsigned int width;
+        unsigned int height;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct IndexEntry {
+        uint64_t record;
+        uint64_t number;
+        uint64_t offset;
+    };
+
+    // Encoder thread body
+    void run();
+
+    // Delta codes one screen and appends its record
+    void encode(const Slot& slot);
+
+    // Writes size bytes at the end of the file, noting failures
+    void write(const unsigned char* data, size_t size);
+
+    FILE* file = nullptr;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    unsigned int keyframeInterval = 300;
+    bool waitWhenFull = false;
+
+    // Single producer, single consumer ring of copied screens, as TraceRing
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0};        // Next slot record() fills
+    alignas(64) std::atomic<size_t> tail{0};        // Next slot the encoder takes
+    std::atomic<uint64_t> recorded{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> bytesWritten{0};
+
+    // Encoder thread state
+    std::vector<unsigned char> previous;            // Screen of the last record
+    unsigned int previousWidth = 0;
+    unsigned int previousHeight = 0;
+    uint64_t recordCount = 0;
+    unsigned int sinceKeyframe = 0;
+    std::vector<IndexEntry> index;
+    std::vector<unsigned char> buffer;              // Record being written
+    bool failed = false;
+};
+
+// Reads the screens of a recording in any order. A screen decodes from the nearest keyframe at
+// or before it, sequential reads continue from the previous one.
+class RecordingReader {
+public:
+    RecordingReader() = default;
+    ~RecordingReader();
+
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+
+    // Opens a recording and loads its seek index, rebuilding it if the recording wasn't closed.
+    // Returns false and sets error if it isn't a readable recording.
+    bool open(const char* path, std::string* error);
+
+    // Returns the number of records
+    size_t size() const;
+
+    // Returns false if the recording has no seek index because it was never closed, as after a
+    // crash. Its records were found by walking them, up to any record cut off at the end.
+    bool wasClosed() const;
+
+    // Decodes record index into frame. Returns false if the record is corrupt or missing.
+    bool read(size_t index, RecordedFrame& frame);
+
+    // Returns the index of the first record captured at or after frame number, size() if none
+    size_t find(uint64_t number);
+
+private:
+    struct Keyframe {
+        uint64_t record;
+        uint64_t number;
+        uint64_t offset;
+    };
+
+    // Loads the index written by FrameRecorder::close(). Returns false if there is none.
+    bool loadIndex(uint64_t fileSize);
+
+    // Walks the records to find the keyframes, stopping at one cut off by the end of the file
+    void scanRecords(uint64_t fileSize);
+
+    // Reads the record at the file position into current, decoding against it
+    bool readNext();
+
+    FILE* file = nullptr;
+    std::vector<Keyframe> keyframes;
+    uint64_t recordCount = 0;
+    bool closed = false;
+    RecordedFrame current = RecordedFrame();
+    uint64_t currentIndex = 0;              // Record in current, valid if hasCurrent
+    bool hasCurrent = false;
+    std::vector<unsigned char> delta;       // Scratch for the record being decoded
+    std::vector<unsigned char> pixels;
+};
+
+#endif //CHIP8_FRAME_RECORDER_H
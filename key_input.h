@@ -0,0 +1,16 @@
+#ifndef CHIP8_KEY_INPUT_H
+#define CHIP8_KEY_INPUT_H
+
+#include <cstdint>
+
+// Source of the hex keypad state. The core polls it once per frame, so it never has to
+// know where the keys come from (SDL, a test harness, a network client...).
+class KeyInput {
+public:
+    virtual ~KeyInput() = default;
+
+    // Returns a snapshot of the keypad, bit n set while key n is pressed
+    virtual uint16_t readKeys() = 0;
+};
+
+#endif //CHIP8_KEY_INPUT_H
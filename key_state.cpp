@@ -0,0 +1,61 @@
+#include "key_state.h"
+#include <chrono>
+
+namespace {
+
+int64_t nowNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+void KeyState::press(unsigned int key) {
+    if (key < 16) {
+        keys.fetch_or(1u << key, std::memory_order_release);
+        onEvent();
+    }
+}
+
+void KeyState::release(unsigned int key) {
+    if (key < 16) {
+        keys.fetch_and(~(1u << key), std::memory_order_release);
+        onEvent();
+    }
+}
+
+void KeyState::set(uint16_t keys) {
+    this->keys.store(keys, std::memory_order_release);
+    onEvent();
+}
+
+uint16_t KeyState::readKeys() {
+    int64_t since = pendingSince.exchange(0, std::memory_order_acq_rel);
+    uint16_t snapshot = keys.load(std::memory_order_acquire);
+    if (since != 0) {
+        uint64_t latency = nowNanoseconds() - since;
+        ++latencyCount;
+        latencyTotal += latency;
+        if (latency > latencyMax) {
+            latencyMax = latency;
+        }
+    }
+    return snapshot;
+}
+
+uint64_t KeyState::getLatencyCount() const {
+    return latencyCount;
+}
+
+uint64_t KeyState::getLatencyTotalNanoseconds() const {
+    return latencyTotal;
+}
+
+uint64_t KeyState::getLatencyMaxNanoseconds() const {
+    return latencyMax;
+}
+
+void KeyState::onEvent() {
+    int64_t expected = 0;
+    pendingSince.compare_exchange_strong(expected, nowNanoseconds(), std::memory_order_acq_rel);
+}
@@ -0,0 +1,44 @@
+#ifndef CHIP8_KEY_STATE_H
+#define CHIP8_KEY_STATE_H
+
+#include <atomic>
+#include <cstdint>
+#include "key_input.h"
+
+// Keypad state maintained from key events, delivered by a frontend or injected by a
+// headless host, and handed to the CPU as one snapshot per frame. Events and snapshots
+// may come from different threads.
+//
+// Also measures input latency: the time from the first event after a snapshot to the
+// snapshot that delivers it to the CPU.
+class KeyState : public KeyInput {
+public:
+    // Key n went down. Keys outside 0x0..0xF are ignored.
+    void press(unsigned int key);
+
+    // Key n went up
+    void release(unsigned int key);
+
+    // Replaces the whole keypad state, bit n for key n
+    void set(uint16_t keys);
+
+    // Returns the current state as the snapshot for the next frame
+    uint16_t readKeys() override;
+
+    // Returns the number of snapshots that delivered events, and their latency in total and at worst
+    uint64_t getLatencyCount() const;
+    uint64_t getLatencyTotalNanoseconds() const;
+    uint64_t getLatencyMaxNanoseconds() const;
+
+private:
+    // Stamps the event time unless an earlier event is still undelivered
+    void onEvent();
+
+    std::atomic<uint16_t> keys{0};
+    std::atomic<int64_t> pendingSince{0};   // steady_clock time of the first undelivered event, 0 if none
+    uint64_t latencyCount = 0;              // Latency counters, only touched by the reader
+    uint64_t latencyTotal = 0;
+    uint64_t latencyMax = 0;
+};
+
+#endif //CHIP8_KEY_STATE_H
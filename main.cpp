@@ -1,123 +1,270 @@
+#include "audio.h"
 #include "chip8.h"
+#include "frame_buffer.h"
+#include "frame_recorder.h"
+#include "replay.h"
+#include "rom_cache.h"
+#include "scheduler.h"
+#include "sdl_audio.h"
+#include "sdl_key_input.h"
+#include "sdl_renderer.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <SDL.h>
 
 const int SCREEN_WIDTH = 1280;
 const int SCREEN_HEIGHT = 640;
 
-// The window we'll be rendering to
-SDL_Window* gWindow = nullptr;
-
-// The window renderer
-SDL_Renderer* gRenderer = nullptr;
+// How long the render loop waits for input when no new frame is there
+const int IDLE_WAIT_MS = 4;
 
 Chip8 myChip8;
 
-bool setupGraphics();
-void drawGraphics();
+// Keypad fed by SDL key events
+SdlKeyInput keyInput;
 
-int main(int argc, char* args[]) {
+// Window and screen texture
+SdlRenderer renderer;
 
-    // Set up render system and register input callbacks
-    setupGraphics();
+// Tone changes from the emulation thread to the audio callback, and the square wave synthesizer on it
+ToneRing toneRing;
+ToneSynth toneSynth(toneRing, AUDIO_SAMPLE_RATE);
+SdlAudio audio;
 
-    // Initialize the Chip8 system and load the game into the memory
-    myChip8.initialize();
+// Session log written with --record, replayable with chip8-run --replay
+InputLog inputLog;
 
-    // Event handler
-    SDL_Event e;
+// Drawn screens written with --capture, exportable with chip8-export
+FrameRecorder frameRecorder;
 
-    bool loadSucceeded = myChip8.loadProgram("TETRIS");
-    if (!loadSucceeded) {
-        printf("Program loading failed!");
-        return 0;
-    }
+// Completed frames, from the emulation thread to the render loop
+FrameBuffer frames;
 
-    // Emulation loop
-    for(;;)
+// Cleared to stop the emulation thread
+std::atomic<bool> running(true);
+
+// Fast-forward, toggled with Tab: the CPU runs uncapped and only some frames are shown
+std::atomic<bool> turbo(false);
+
+// Frames shown while fast-forwarding, every Nth emulated frame. 0 shows one per display refresh.
+unsigned int turboSkip = 0;
+
+// Counts key events, Tab and quit, and wakes the emulation thread sleeping on an idle machine
+std::mutex inputMutex;
+std::condition_variable inputChanged;
+unsigned long long inputEvents = 0;
+
+// Called by the render loop for every event that may wake the emulation thread
+void notifyInput() {
     {
-        while(SDL_PollEvent(&e) != 0) {
-            if(e.type == SDL_QUIT) {
-                return 0;
-            }
+        std::lock_guard<std::mutex> lock(inputMutex);
+        ++inputEvents;
+    }
+    inputChanged.notify_one();
+}
+
+// Emulation thread: runs the CPU in 60 Hz frames and publishes every frame that drew something.
+// Never waits for the renderer. Halted in Fx0A or by 00FD a frame costs next to nothing, and
+// keeps the timers and the input log ticking.
+//
+// Fast-forwarding runs frames back to back, the timers still ticking once per emulated frame,
+// and skips capturing the frames that won't be shown. The draw flag stays set until one is.
+// An idle machine (see Chip8::isIdle()) sleeps until the next input event instead of spinning
+// through frames that change nothing, after showing its last drawn frame.
+void runEmulation(Scheduler& scheduler, bool recording) {
+    bool uncapped = false;
+    while (running.load(std::memory_order_acquire)) {
+        bool fast = turbo.load(std::memory_order_relaxed);
+        if (fast != uncapped) {
+            uncapped = fast;
+            scheduler.setUncapped(uncapped);
         }
-        // Clear screen
-        SDL_SetRenderDrawColor( gRenderer, 0x00, 0x0011, 0x00, 0xFF );
-        SDL_RenderClear( gRenderer );
-        // Emulate one cycle
-        myChip8.emulateCycle();
-
-        // If the draw flag is set, update the screen
-        if(myChip8.getDrawFlag()) {
-            drawGraphics();
+
+        // Taken before the key snapshot, so an event arriving during the frame still wakes us
+        unsigned long long seenEvents;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            seenEvents = inputEvents;
         }
 
-        // Store key press state (Press and Release)
-        // NOTE: Currently implemented as continuous-response keys
+        // Hand the CPU this frame's key snapshot
         myChip8.setKeys();
-        SDL_RenderPresent( gRenderer );
-        SDL_Delay( 2 );
+
+        // Emulate one frame worth of cycles and tick the timers
+        scheduler.runFrame();
+        if (recording) {
+            inputLog.recordFrame(myChip8);
+        }
+        frameRecorder.record(myChip8, scheduler.getFrameCount());
+
+        bool idle = uncapped && myChip8.isIdle();
+        bool show = myChip8.getDrawFlag();
+        if (show && uncapped && !idle) {
+            show = turboSkip > 0 ? scheduler.getFrameCount() % turboSkip == 0 : !frames.isPending();
+        }
+        if (show) {
+            frames.back().capture(myChip8, scheduler.getFrameCount());
+            frames.publish();
+            myChip8.clearDrawFlag();
+        }
+
+        if (idle) {
+            std::unique_lock<std::mutex> lock(inputMutex);
+            inputChanged.wait(lock, [seenEvents] { return inputEvents != seenEvents; });
+            continue;
+        }
+        scheduler.waitForNextFrame();
     }
 }
 
-bool setupGraphics() {
-    // Initialization flag
-    bool success = true;
-
-    // Initialize SDL
-    if( SDL_Init( SDL_INIT_VIDEO ) < 0 )
-    {
-        std::cout << "SDL could not initialize! SDL_Error: " << SDL_GetError() << "\n";
-        success = false;
+// Prints how long key events took to reach the CPU
+void printInputLatency() {
+    uint64_t count = keyInput.getLatencyCount();
+    if (count > 0) {
+        printf("Input latency over %llu frames: mean %.2f ms, max %.2f ms\n", (unsigned long long) count,
+               keyInput.getLatencyTotalNanoseconds() / 1e6 / count, keyInput.getLatencyMaxNanoseconds() / 1e6);
     }
-    else
-    {
-        // Create window
-        gWindow = SDL_CreateWindow( "Chip8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN );
-        if( gWindow == nullptr )
-        {
-            std::cout << "Window could not be created! SDL_Error: " << SDL_GetError() << "\n";
-            success = false;
-        }
-        else
-        {
-            // Create renderer for window
-            gRenderer = SDL_CreateRenderer( gWindow, -1, SDL_RENDERER_ACCELERATED );
-            if( gRenderer == nullptr )
-            {
-                std::cout << "Renderer could not be created! SDL Error: " << SDL_GetError() << "\n";
-                success = false;
+}
+
+// Usage: chip8 [--record <log>] [--capture <recording>] [--keys "<16 SDL key names for 0..F>"]
+//              [--platform chip8|schip|xochip] [--quirks cosmac|modern|schip|xochip] [--turbo-skip N] [rom]
+int main(int argc, char* args[]) {
+    const char* romPath = "TETRIS";
+    const char* recordPath = nullptr;
+    const char* capturePath = nullptr;
+    Chip8::Platform platform = Chip8::PLATFORM_CHIP8;
+    Chip8::Quirks quirks = Chip8::QUIRKS_MODERN;
+    bool quirksGiven = false;
+    for (int argi = 1; argi < argc; ++argi) {
+        if (std::strcmp(args[argi], "--record") == 0 && argi + 1 < argc) {
+            recordPath = args[++argi];
+        } else if (std::strcmp(args[argi], "--capture") == 0 && argi + 1 < argc) {
+            capturePath = args[++argi];
+        } else if (std::strcmp(args[argi], "--turbo-skip") == 0 && argi + 1 < argc) {
+            turboSkip = std::strtoul(args[++argi], nullptr, 10);
+        } else if (std::strcmp(args[argi], "--platform") == 0 && argi + 1 < argc) {
+            if (!Chip8::parsePlatform(args[++argi], platform)) {
+                printf("Unknown platform: %s\n", args[argi]);
+                return 1;
             }
-            else
-            {
-                // Initialize renderer color
-                SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );
+        } else if (std::strcmp(args[argi], "--quirks") == 0 && argi + 1 < argc) {
+            if (!Chip8::parseQuirks(args[++argi], quirks)) {
+                printf("Unknown quirks: %s\n", args[argi]);
+                return 1;
             }
-
+            quirksGiven = true;
+        } else if (std::strcmp(args[argi], "--keys") == 0 && argi + 1 < argc) {
+            if (!keyInput.setLayout(args[++argi])) {
+                printf("Invalid key layout: %s\n", args[argi]);
+                return 1;
+            }
+        } else {
+            romPath = args[argi];
         }
     }
 
-    return success;
-}
+    // Set up render system
+    if (!renderer.initialize("Chip8", SCREEN_WIDTH, SCREEN_HEIGHT)) {
+        return 0;
+    }
 
-void drawGraphics() {
-    int scale = 20;
-    const unsigned char* graphicsRaw = myChip8.getGraphics();
-    for (unsigned short yLine = 0; yLine < 32; ++yLine) {
-        for (unsigned short xLine = 0; xLine < 64; ++xLine) {
-            if (graphicsRaw[xLine + yLine * 64] != 0) {
-                auto x = xLine * scale;
-                auto y = yLine * scale;
-                SDL_Rect fillRect = { x, y, scale, scale};
-                SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
-                SDL_RenderFillRect( gRenderer, &fillRect );
-            } else {
-                auto x = xLine * scale;
-                auto y = yLine * scale;
-                SDL_Rect fillRect = { x, y, scale, scale};
-                SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );
-                SDL_RenderFillRect( gRenderer, &fillRect );
+    // Initialize the Chip8 system and load the game into the memory
+    std::shared_ptr<const RomImage> rom = RomCache::instance().load(romPath);
+    if (rom == nullptr) {
+        printf("Program loading failed!");
+        return 0;
+    }
+    uint32_t seed = std::time(nullptr);
+    if (!quirksGiven) {
+        quirks = Chip8::defaultQuirks(platform);
+    }
+    myChip8.initialize(seed, platform, quirks);
+    if (!myChip8.loadProgram(*rom)) {
+        printf("Program too large for %s!", Chip8::platformName(platform));
+        return 0;
+    }
+
+    // Plays silently without an audio device
+    if (audio.initialize(toneSynth)) {
+        myChip8.setAudio(&toneRing);
+    }
+
+    // Runs the CPU in 60 Hz frames
+    Scheduler scheduler(myChip8);
+
+    // Keys go through the recorder when recording
+    RecordingKeyInput recorder(&keyInput, inputLog);
+    if (recordPath != nullptr) {
+        inputLog.begin(rom->hash(), seed, scheduler.getInstructionsPerFrame(), platform, quirks);
+        myChip8.setKeyInput(&recorder);
+    } else {
+        myChip8.setKeyInput(&keyInput);
+    }
+
+    if (capturePath != nullptr && !frameRecorder.open(capturePath)) {
+        printf("Could not create recording %s\n", capturePath);
+        return 0;
+    }
+
+    std::thread emulation(runEmulation, std::ref(scheduler), recordPath != nullptr);
+
+    // Event handler
+    SDL_Event e;
+
+    // Last frame uploaded to the screen texture, for finding the rows that changed.
+    // Zero width makes the first frame upload everything.
+    Frame shown = Frame();
+
+    // Render loop on the main thread, which SDL wants events and rendering on. Presents the
+    // newest frame at display refresh; key events go straight to the keypad state.
+    for(;;)
+    {
+        while(SDL_PollEvent(&e) != 0) {
+            if(e.type == SDL_QUIT) {
+                running.store(false, std::memory_order_release);
+                notifyInput();
+                emulation.join();
+                if(recordPath != nullptr && !inputLog.save(recordPath)) {
+                    printf("Could not write input log %s\n", recordPath);
+                }
+                if(capturePath != nullptr && !frameRecorder.close()) {
+                    printf("Could not write recording %s\n", capturePath);
+                }
+                printInputLatency();
+                printf("Frames drawn %llu, skipped by the renderer %llu\n",
+                       (unsigned long long) frames.getPublishedCount(), (unsigned long long) frames.getDroppedCount());
+                return 0;
+            }
+            if(keyInput.handleEvent(e)) {
+                notifyInput();
+            } else if(e.type == SDL_KEYDOWN && e.key.repeat == 0 && e.key.keysym.scancode == SDL_SCANCODE_TAB) {
+                // Tab toggles fast-forward, unless the key layout uses it
+                bool fast = !turbo.load(std::memory_order_relaxed);
+                turbo.store(fast, std::memory_order_relaxed);
+                printf("Fast-forward %s\n", fast ? "on" : "off");
+                notifyInput();
             }
         }
+
+        // Nothing new to show: wait for input rather than presenting the same picture again
+        const Frame* frame = frames.acquire();
+        if(frame == nullptr) {
+            SDL_WaitEventTimeout(nullptr, IDLE_WAIT_MS);
+            continue;
+        }
+
+        renderer.update(frame->rows[0][0], frame->planeCount > 1 ? frame->rows[1][0] : nullptr,
+                        frame->width, frame->height, frame->diffRows(shown));
+        shown = *frame;
+
+        // Blocks on vsync, the emulation thread carries on meanwhile
+        renderer.present();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,245 @@
+#include "profiler.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+
+const char* const FAMILY_NAMES[Profiler::FAMILY_COUNT] = {
+        "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+        "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+        "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+        "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+        "00CN", "00FB", "00FC", "00FD", "00FE", "00FF", "FX30", "FX75", "FX85",
+        "00DN", "5XY2", "5XY3", "F000", "F002", "FN01", "FX3A",
+        "unknown"
+};
+
+}
+
+Profiler::Profiler() {
+    reset();
+}
+
+void Profiler::reset() {
+    instructions = 0;
+    for (int i = 0; i < FAMILY_COUNT; ++i) {
+        families[i] = 0;
+    }
+    pcs.assign(65536, 0);
+    draws = 0;
+    collisions = 0;
+    keyWaits = 0;
+    keyWaitNanoseconds = 0;
+    nodes.clear();
+    nodes.push_back({0x200, -1, 0, {}});
+    current = 0;
+}
+
+void Profiler::onInstruction(unsigned short pc, unsigned short opcode) {
+    Family family = familyOf(opcode);
+    ++instructions;
+    ++families[family];
+    ++pcs[pc];
+    ++nodes[current].instructions;
+
+    // Follow the call stack: the call itself is charged to the caller
+    if (family == OP_2NNN) {
+        unsigned short target = opcode & 0x0FFF;
+        auto found = nodes[current].children.find(target);
+        if (found != nodes[current].children.end()) {
+            current = found->second;
+        } else {
+            int child = nodes.size();
+            nodes.push_back({target, current, 0, {}});
+            nodes[current].children[target] = child;
+            current = child;
+        }
+    } else if (family == OP_00EE && nodes[current].parent >= 0) {
+        current = nodes[current].parent;
+    }
+}
+
+void Profiler::onDraw(bool collision) {
+    ++draws;
+    if (collision) {
+        ++collisions;
+    }
+}
+
+void Profiler::onKeyWait(uint64_t nanoseconds) {
+    ++keyWaits;
+    keyWaitNanoseconds += nanoseconds;
+}
+
+Profiler::Family Profiler::familyOf(unsigned short opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            // Whole opcodes, SUPER-CHIP and XO-CHIP pack more instructions in here
+            switch (opcode & 0xFFF0) {
+                case 0x00C0: return OP_00CN;
+                case 0x00D0: return OP_00DN;
+            }
+            switch (opcode) {
+                case 0x00E0: return OP_00E0;
+                case 0x00EE: return OP_00EE;
+                case 0x00FB: return OP_00FB;
+                case 0x00FC: return OP_00FC;
+                case 0x00FD: return OP_00FD;
+                case 0x00FE: return OP_00FE;
+                case 0x00FF: return OP_00FF;
+            }
+            break;
+        case 0x1000: return OP_1NNN;
+        case 0x2000: return OP_2NNN;
+        case 0x3000: return OP_3XNN;
+        case 0x4000: return OP_4XNN;
+        case 0x5000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OP_5XY0;
+                case 0x0002: return OP_5XY2;
+                case 0x0003: return OP_5XY3;
+            }
+            break;
+        case 0x6000: return OP_6XNN;
+        case 0x7000: return OP_7XNN;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OP_8XY0;
+                case 0x0001: return OP_8XY1;
+                case 0x0002: return OP_8XY2;
+                case 0x0003: return OP_8XY3;
+                case 0x0004: return OP_8XY4;
+                case 0x0005: return OP_8XY5;
+                case 0x0006: return OP_8XY6;
+                case 0x0007: return OP_8XY7;
+                case 0x000E: return OP_8XYE;
+            }
+            break;
+        case 0x9000:
+            if ((opcode & 0x000F) == 0) {
+                return OP_9XY0;
+            }
+            break;
+        case 0xA000: return OP_ANNN;
+        case 0xB000: return OP_BNNN;
+        case 0xC000: return OP_CXNN;
+        case 0xD000: return OP_DXYN;
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: return OP_EX9E;
+                case 0x00A1: return OP_EXA1;
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0000: return opcode == 0xF000 ? OP_F000 : OP_UNKNOWN;
+                case 0x0001: return OP_FN01;
+                case 0x0002: return opcode == 0xF002 ? OP_F002 : OP_UNKNOWN;
+                case 0x0007: return OP_FX07;
+                case 0x000A: return OP_FX0A;
+                case 0x0015: return OP_FX15;
+                case 0x0018: return OP_FX18;
+                case 0x001E: return OP_FX1E;
+                case 0x0029: return OP_FX29;
+                case 0x0033: return OP_FX33;
+                case 0x0055: return OP_FX55;
+                case 0x0065: return OP_FX65;
+                case 0x0030: return OP_FX30;
+                case 0x003A: return OP_FX3A;
+                case 0x0075: return OP_FX75;
+                case 0x0085: return OP_FX85;
+            }
+            break;
+    }
+    return OP_UNKNOWN;
+}
+
+const char* Profiler::familyName(Family family) {
+    return FAMILY_NAMES[family];
+}
+
+uint64_t Profiler::getInstructionCount() const {
+    return instructions;
+}
+
+uint64_t Profiler::getFamilyCount(Family family) const {
+    return families[family];
+}
+
+uint64_t Profiler::getPcCount(unsigned short pc) const {
+    return pcs[pc];
+}
+
+uint64_t Profiler::getDrawCount() const {
+    return draws;
+}
+
+uint64_t Profiler::getCollisionCount() const {
+    return collisions;
+}
+
+uint64_t Profiler::getKeyWaitCount() const {
+    return keyWaits;
+}
+
+uint64_t Profiler::getKeyWaitNanoseconds() const {
+    return keyWaitNanoseconds;
+}
+
+void Profiler::writeJson(FILE* out) const {
+    fprintf(out, "{\n  \"instructions\": %llu,\n", (unsigned long long) instructions);
+    fprintf(out, "  \"draws\": %llu,\n  \"collisions\": %llu,\n", (unsigned long long) draws,
+            (unsigned long long) collisions);
+    fprintf(out, "  \"key_waits\": %llu,\n  \"key_wait_ns\": %llu,\n", (unsigned long long) keyWaits,
+            (unsigned long long) keyWaitNanoseconds);
+
+    fprintf(out, "  \"families\": {");
+    bool first = true;
+    for (int i = 0; i < FAMILY_COUNT; ++i) {
+        if (families[i] != 0) {
+            fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", FAMILY_NAMES[i], (unsigned long long) families[i]);
+            first = false;
+        }
+    }
+    fprintf(out, "\n  },\n");
+
+    std::vector<unsigned short> hot;
+    for (unsigned int pc = 0; pc < pcs.size(); ++pc) {
+        if (pcs[pc] != 0) {
+            hot.push_back(pc);
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [this](unsigned short a, unsigned short b) { return pcs[a] > pcs[b]; });
+
+    fprintf(out, "  \"pcs\": [");
+    first = true;
+    for (unsigned short pc : hot) {
+        fprintf(out, "%s\n    {\"pc\": \"0x%03X\", \"count\": %llu}", first ? "" : ",", pc,
+                (unsigned long long) pcs[pc]);
+        first = false;
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+void Profiler::writeFolded(FILE* out) const {
+    std::string stack;
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].instructions == 0) {
+            continue;
+        }
+        stack.clear();
+        appendStack(i, stack);
+        fprintf(out, "%s %llu\n", stack.c_str(), (unsigned long long) nodes[i].instructions);
+    }
+}
+
+void Profiler::appendStack(int node, std::string& out) const {
+    if (nodes[node].parent < 0) {
+        out += "main";
+        return;
+    }
+    appendStack(nodes[node].parent, out);
+    char frame[8];
+    snprintf(frame, sizeof(frame), ";0x%03X", nodes[node].address);
+    out += frame;
+}
@@ -0,0 +1,96 @@
+#ifndef CHIP8_PROFILER_H
+#define CHIP8_PROFILER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+// Execution profile of a Chip8: executions per opcode family and per pc, draws,
+// collisions, time spent waiting in Fx0A, and instruction counts per 2NNN/00EE call
+// stack. Fed by the Chip8 hooks, which only exist when the core is built with
+// CHIP8_PROFILE; otherwise Chip8::setProfiler() has no effect and this stays empty.
+class Profiler {
+public:
+    // Opcode families, one per instruction the interpreter knows on any platform plus one for
+    // the rest
+    enum Family {
+        OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN, OP_7XNN,
+        OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+        OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+        OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65,
+        OP_00CN, OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF, OP_FX30, OP_FX75, OP_FX85,   // SUPER-CHIP
+        OP_00DN, OP_5XY2, OP_5XY3, OP_F000, OP_F002, OP_FN01, OP_FX3A,                      // XO-CHIP
+        OP_UNKNOWN,
+        FAMILY_COUNT
+    };
+
+    Profiler();
+
+    // Drops everything collected so far
+    void reset();
+
+    // Hook: the instruction at pc is about to execute
+    void onInstruction(unsigned short pc, unsigned short opcode);
+
+    // Hook: a DXYN finished, collision is its VF result
+    void onDraw(bool collision);
+
+    // Hook: an Fx0A spent nanoseconds waiting for a key
+    void onKeyWait(uint64_t nanoseconds);
+
+    // Returns the family of opcode
+    static Family familyOf(unsigned short opcode);
+
+    // Returns the printable name of family, e.g. "8XY4"
+    static const char* familyName(Family family);
+
+    // Returns the number of executed instructions
+    uint64_t getInstructionCount() const;
+
+    // Returns the number of executed instructions of family
+    uint64_t getFamilyCount(Family family) const;
+
+    // Returns how often the instruction at pc executed
+    uint64_t getPcCount(unsigned short pc) const;
+
+    // Returns the number of DXYN draws and how many of them collided
+    uint64_t getDrawCount() const;
+    uint64_t getCollisionCount() const;
+
+    // Returns the number of Fx0A waits and their total duration
+    uint64_t getKeyWaitCount() const;
+    uint64_t getKeyWaitNanoseconds() const;
+
+    // Writes the counters as JSON, the pc histogram sorted hottest first
+    void writeJson(FILE* out) const;
+
+    // Writes instruction counts per call stack in the folded format flamegraph tools take,
+    // one "main;0x2D4;0x300 <count>" line per stack
+    void writeFolded(FILE* out) const;
+
+private:
+    // Call tree node, one per distinct call stack
+    struct Node {
+        unsigned short address;                     // Subroutine entry, 0x200 for the root
+        int parent;                                 // Index of the caller, -1 for the root
+        uint64_t instructions;                      // Instructions executed in this frame itself
+        std::map<unsigned short, int> children;     // Callees by entry address
+    };
+
+    // Appends the stack of node to out, outermost first
+    void appendStack(int node, std::string& out) const;
+
+    uint64_t instructions;
+    uint64_t families[FAMILY_COUNT];
+    std::vector<uint64_t> pcs;
+    uint64_t draws;
+    uint64_t collisions;
+    uint64_t keyWaits;
+    uint64_t keyWaitNanoseconds;
+    std::vector<Node> nodes;
+    int current;                                    // Node of the executing frame
+};
+
+#endif //CHIP8_PROFILER_H
@@ -0,0 +1,232 @@
+#include "replay.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const size_t HEADER_SIZE_V1 = 4 + 2 + 2 + 8 + 4 + 4 + 8 + 8;
+const size_t HEADER_SIZE = HEADER_SIZE_V1 + 2;
+const size_t KEY_CHANGE_SIZE = 8 + 2;
+
+void putU16(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void putU32(std::vector<unsigned char>& out, uint32_t value) {
+    putU16(out, value & 0xFFFF);
+    putU16(out, value >> 16);
+}
+
+void putU64(std::vector<unsigned char>& out, uint64_t value) {
+    putU32(out, value & 0xFFFFFFFF);
+    putU32(out, value >> 32);
+}
+
+uint16_t getU16(const unsigned char* in) {
+    return in[0] | (in[1] << 8);
+}
+
+uint32_t getU32(const unsigned char* in) {
+    return getU16(in) | ((uint32_t) getU16(in + 2) << 16);
+}
+
+uint64_t getU64(const unsigned char* in) {
+    return getU32(in) | ((uint64_t) getU32(in + 4) << 32);
+}
+
+}
+
+void InputLog::begin(uint64_t romHash, uint32_t seed, unsigned int instructionsPerFrame,
+                     Chip8::Platform platform, Chip8::Quirks quirks) {
+    this->romHash = romHash;
+    this->seed = seed;
+    this->instructionsPerFrame = instructionsPerFrame;
+    this->platform = platform;
+    this->quirks = quirks;
+    keyChanges.clear();
+    frameHashes.clear();
+}
+
+void InputLog::recordKeys(uint16_t keys) {
+    uint64_t frame = frameHashes.size();
+    if (!keyChanges.empty() && keyChanges.back().frame == frame) {
+        // Polled again within the frame, the last state is the one it runs with
+        keyChanges.pop_back();
+    }
+    uint16_t previous = keyChanges.empty() ? 0 : keyChanges.back().keys;
+    if (keys != previous) {
+        keyChanges.push_back({frame, keys});
+    }
+}
+
+void InputLog::recordFrame(const Chip8& chip8) {
+    frameHashes.push_back(hashFramebuffer(chip8));
+}
+
+uint16_t InputLog::keysAt(uint64_t frame) const {
+    // Last change at or before frame
+    auto next = std::upper_bound(keyChanges.begin(), keyChanges.end(), frame,
+                                 [](uint64_t f, const KeyChange& change) { return f < change.frame; });
+    return next == keyChanges.begin() ? 0 : (next - 1)->keys;
+}
+
+uint64_t InputLog::getFrameHash(uint64_t frame) const {
+    return frameHashes[frame];
+}
+
+uint64_t InputLog::getFrameCount() const {
+    return frameHashes.size();
+}
+
+uint64_t InputLog::getRomHash() const {
+    return romHash;
+}
+
+uint32_t InputLog::getSeed() const {
+    return seed;
+}
+
+unsigned int InputLog::getInstructionsPerFrame() const {
+    return instructionsPerFrame;
+}
+
+Chip8::Platform InputLog::getPlatform() const {
+    return platform;
+}
+
+Chip8::Quirks InputLog::getQuirks() const {
+    return quirks;
+}
+
+bool InputLog::save(const char* path) const {
+    std::vector<unsigned char> out;
+    out.reserve(HEADER_SIZE + keyChanges.size() * KEY_CHANGE_SIZE + frameHashes.size() * 8);
+    out.insert(out.end(), INPUT_LOG_MAGIC, INPUT_LOG_MAGIC + 4);
+    putU16(out, INPUT_LOG_VERSION);
+    putU16(out, platform);
+    putU64(out, romHash);
+    putU32(out, seed);
+    putU32(out, instructionsPerFrame);
+    putU64(out, keyChanges.size());
+    putU64(out, frameHashes.size());
+    putU16(out, quirks);
+    for (const KeyChange& change : keyChanges) {
+        putU64(out, change.frame);
+        putU16(out, change.keys);
+    }
+    for (uint64_t hash : frameHashes) {
+        putU64(out, hash);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    return fclose(file) == 0 && written;
+}
+
+bool InputLog::load(const char* path, std::string* error) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        *error = std::string("cannot open ") + path;
+        return false;
+    }
+    std::vector<unsigned char> in;
+    unsigned char chunk[4096];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        in.insert(in.end(), chunk, chunk + count);
+    }
+    fclose(file);
+
+    if (in.size() < HEADER_SIZE_V1 || std::memcmp(in.data(), INPUT_LOG_MAGIC, 4) != 0) {
+        *error = std::string(path) + " is not an input log";
+        return false;
+    }
+    uint16_t version = getU16(in.data() + 4);
+    if (version != 1 && version != INPUT_LOG_VERSION) {
+        *error = std::string(path) + " is from an unsupported input log version";
+        return false;
+    }
+    size_t headerSize = version == 1 ? HEADER_SIZE_V1 : HEADER_SIZE;
+    if (in.size() < headerSize) {
+        *error = std::string(path) + " is truncated or corrupt";
+        return false;
+    }
+    // Version 1 ran every platform with what is QUIRKS_MODERN now
+    uint16_t quirksField = version == 1 ? (uint16_t) Chip8::QUIRKS_MODERN : getU16(in.data() + HEADER_SIZE_V1);
+    // The platform field was reserved before, logs from then are CHIP-8 with 0 there
+    if (getU16(in.data() + 6) >= Chip8::PLATFORM_COUNT) {
+        *error = std::string(path) + " is for an unknown platform";
+        return false;
+    }
+    if (quirksField >= Chip8::QUIRKS_COUNT) {
+        *error = std::string(path) + " is for unknown quirks";
+        return false;
+    }
+    uint64_t changeCount = getU64(in.data() + 24);
+    uint64_t frameCount = getU64(in.data() + 32);
+    if (changeCount > in.size() / KEY_CHANGE_SIZE || frameCount > in.size() / 8 ||
+        in.size() != headerSize + changeCount * KEY_CHANGE_SIZE + frameCount * 8) {
+        *error = std::string(path) + " is truncated or corrupt";
+        return false;
+    }
+
+    romHash = getU64(in.data() + 8);
+    seed = getU32(in.data() + 16);
+    instructionsPerFrame = getU32(in.data() + 20);
+    platform = static_cast<Chip8::Platform>(getU16(in.data() + 6));
+    quirks = static_cast<Chip8::Quirks>(quirksField);
+    keyChanges.resize(changeCount);
+    frameHashes.resize(frameCount);
+    const unsigned char* p = in.data() + headerSize;
+    for (KeyChange& change : keyChanges) {
+        change.frame = getU64(p);
+        change.keys = getU16(p + 8);
+        p += KEY_CHANGE_SIZE;
+    }
+    for (uint64_t& hash : frameHashes) {
+        hash = getU64(p);
+        p += 8;
+    }
+    return true;
+}
+
+uint64_t InputLog::hashFramebuffer(const Chip8& chip8) {
+    // FNV-1a over the rows in use of every plane as little-endian bytes, so logs verify on any
+    // host. A lo-res CHIP-8 screen hashes its 32 single-word rows, as it always has.
+    unsigned int words = chip8.getWidth() / 64;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (unsigned int plane = 0; plane < chip8.getPlaneCount(); ++plane) {
+        const uint64_t* rows = chip8.getFramebuffer(plane);
+        for (unsigned int row = 0; row < chip8.getHeight(); ++row) {
+            for (unsigned int word = 0; word < words; ++word) {
+                for (int shift = 0; shift < 64; shift += 8) {
+                    hash ^= (rows[row * Chip8::ROW_WORDS + word] >> shift) & 0xFF;
+                    hash *= 0x100000001B3ull;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+RecordingKeyInput::RecordingKeyInput(KeyInput* source, InputLog& log) : source(source), log(log) {
+}
+
+uint16_t RecordingKeyInput::readKeys() {
+    uint16_t keys = source != nullptr ? source->readKeys() : 0;
+    log.recordKeys(keys);
+    return keys;
+}
+
+ReplayKeyInput::ReplayKeyInput(const InputLog& log, const Scheduler& scheduler) : log(log), scheduler(scheduler) {
+}
+
+uint16_t ReplayKeyInput::readKeys() {
+    return log.keysAt(scheduler.getFrameCount());
+}
@@ -0,0 +1,100 @@
+#ifndef CHIP8_REPLAY_H
+#define CHIP8_REPLAY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "key_input.h"
+
+class Scheduler;
+
+// Log file layout: "C8IL", u16 version, u16 platform, u64 ROM hash, u32 seed,
+// u32 instructions per frame, u64 key change count, u64 frame count, u16 quirks, then the key
+// changes as u64 frame, u16 keys and one u64 framebuffer hash per frame, all little-endian.
+// Version 1 logs have no quirks field, they ran with QUIRKS_MODERN on every platform.
+const char INPUT_LOG_MAGIC[4] = { 'C', '8', 'I', 'L' };
+const uint16_t INPUT_LOG_VERSION = 2;
+
+// A recorded session: the ROM, seed, platform, quirks and frame budget the Chip8 ran with, the keypad
+// state whenever it changed, and a hash of the framebuffer after every frame. Feeding the
+// keys back to a Chip8 set up the same way must reproduce every hash.
+class InputLog {
+public:
+    // Starts an empty log for a new session
+    void begin(uint64_t romHash, uint32_t seed, unsigned int instructionsPerFrame,
+               Chip8::Platform platform = Chip8::PLATFORM_CHIP8, Chip8::Quirks quirks = Chip8::QUIRKS_MODERN);
+
+    // Records the keypad state, bit n for key n, in effect for the frame being run.
+    // Only changes are stored.
+    void recordKeys(uint16_t keys);
+
+    // Records the screen of chip8 at the end of a frame and moves on to the next one
+    void recordFrame(const Chip8& chip8);
+
+    // Returns the keypad state in effect during frame
+    uint16_t keysAt(uint64_t frame) const;
+
+    // Returns the framebuffer hash recorded at the end of frame
+    uint64_t getFrameHash(uint64_t frame) const;
+
+    // Returns the number of recorded frames
+    uint64_t getFrameCount() const;
+
+    uint64_t getRomHash() const;
+    uint32_t getSeed() const;
+    unsigned int getInstructionsPerFrame() const;
+    Chip8::Platform getPlatform() const;
+    Chip8::Quirks getQuirks() const;
+
+    // Writes the log to path. Returns false if the file can't be written.
+    bool save(const char* path) const;
+
+    // Reads a log written by save(). Returns false and sets error if it can't.
+    bool load(const char* path, std::string* error);
+
+    // Returns the hash recordFrame() stores for the screen of chip8
+    static uint64_t hashFramebuffer(const Chip8& chip8);
+
+private:
+    struct KeyChange {
+        uint64_t frame;             // First frame the keys are in effect
+        uint16_t keys;
+    };
+
+    uint64_t romHash = 0;
+    uint32_t seed = 0;
+    unsigned int instructionsPerFrame = 0;
+    Chip8::Platform platform = Chip8::PLATFORM_CHIP8;
+    Chip8::Quirks quirks = Chip8::QUIRKS_MODERN;
+    std::vector<KeyChange> keyChanges;
+    std::vector<uint64_t> frameHashes;
+};
+
+// Keypad source that passes another source through and records it into a log.
+// Expects to be polled once per frame, before the frame runs.
+class RecordingKeyInput : public KeyInput {
+public:
+    // source may be nullptr, which records all keys released
+    RecordingKeyInput(KeyInput* source, InputLog& log);
+
+    uint16_t readKeys() override;
+
+private:
+    KeyInput* source;
+    InputLog& log;
+};
+
+// Keypad source that plays a log back, following the frames of a scheduler
+class ReplayKeyInput : public KeyInput {
+public:
+    ReplayKeyInput(const InputLog& log, const Scheduler& scheduler);
+
+    uint16_t readKeys() override;
+
+private:
+    const InputLog& log;
+    const Scheduler& scheduler;
+};
+
+#endif //CHIP8_REPLAY_H
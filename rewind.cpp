@@ -0,0 +1,88 @@
+#include "rewind.h"
+#include "delta.h"
+
+RewindBuffer::RewindBuffer(size_t capacity, unsigned int keyframeInterval)
+        : capacity(capacity), keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1) {
+    // A keyframe group longer than the history would evict itself, the newest state included
+    if (capacity > 0 && this->keyframeInterval > capacity) {
+        this->keyframeInterval = capacity;
+    }
+}
+
+void RewindBuffer::push(Chip8& chip8) {
+    chip8.saveState(state);
+
+    Entry entry;
+    entry.keyframe = entries.empty() || sinceKeyframe + 1 >= keyframeInterval;
+    if (entry.keyframe) {
+        encodeDelta(nullptr, state.data(), state.size(), entry.data);
+        keyframeState = state;
+        sinceKeyframe = 0;
+    } else {
+        encodeDelta(keyframeState.data(), state.data(), state.size(), entry.data);
+        ++sinceKeyframe;
+    }
+    entry.data.shrink_to_fit();
+    bytes += entry.data.size();
+    entries.push_back(std::move(entry));
+
+    // Evict the oldest keyframe together with its deltas
+    while (entries.size() > capacity) {
+        do {
+            bytes -= entries.front().data.size();
+            entries.pop_front();
+        } while (!entries.empty() && !entries.front().keyframe);
+    }
+    if (entries.empty()) {
+        sinceKeyframe = 0;
+    }
+}
+
+bool RewindBuffer::rewind(Chip8& chip8) {
+    if (entries.empty()) {
+        return false;
+    }
+
+    Entry entry = std::move(entries.back());
+    entries.pop_back();
+    bytes -= entry.data.size();
+
+    state.resize(chip8.getStateSize());
+    const unsigned char* reference = entry.keyframe ? nullptr : keyframeState.data();
+    bool decoded = decodeDelta(reference, entry.data.data(), entry.data.size(), state.data(), state.size());
+
+    if (entry.keyframe) {
+        reloadKeyframe();
+    } else {
+        --sinceKeyframe;
+    }
+
+    return decoded && chip8.loadState(state.data(), state.size());
+}
+
+void RewindBuffer::clear() {
+    entries.clear();
+    bytes = 0;
+    sinceKeyframe = 0;
+}
+
+size_t RewindBuffer::size() const {
+    return entries.size();
+}
+
+size_t RewindBuffer::memoryUsage() const {
+    return bytes;
+}
+
+void RewindBuffer::reloadKeyframe() {
+    sinceKeyframe = 0;
+    for (size_t i = entries.size(); i-- > 0; ) {
+        if (entries[i].keyframe) {
+            keyframeState.resize(state.size());
+            decodeDelta(nullptr, entries[i].data.data(), entries[i].data.size(), keyframeState.data(),
+                        keyframeState.size());
+            return;
+        }
+        ++sinceKeyframe;
+    }
+}
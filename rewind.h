@@ -0,0 +1,51 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include <deque>
+#include <vector>
+#include "chip8.h"
+
+// In-memory history of Chip8 states for stepping back in time.
+// Every keyframeInterval-th state is stored as a keyframe, the ones in between as
+// XOR/RLE deltas against their keyframe (see delta.h), so any state restores with at
+// most two decodes. The oldest keyframe and its deltas are dropped once the history
+// holds more than capacity states; keyframeInterval is clamped to capacity so the newest
+// keyframe always stays.
+class RewindBuffer {
+public:
+    RewindBuffer(size_t capacity, unsigned int keyframeInterval);
+
+    // Records the current state of chip8 as the newest entry
+    void push(Chip8& chip8);
+
+    // Restores the newest entry into chip8 and removes it. Returns false if the history is empty.
+    bool rewind(Chip8& chip8);
+
+    // Drops the whole history
+    void clear();
+
+    // Returns the number of recorded states
+    size_t size() const;
+
+    // Returns the bytes used by the encoded states
+    size_t memoryUsage() const;
+
+private:
+    struct Entry {
+        bool keyframe;
+        std::vector<unsigned char> data;    // Delta against zero (keyframes) or the entry's keyframe
+    };
+
+    // Decodes the newest keyframe into keyframeState, after the one it had was rewound
+    void reloadKeyframe();
+
+    size_t capacity;
+    unsigned int keyframeInterval;
+    std::deque<Entry> entries;
+    size_t bytes = 0;
+    unsigned int sinceKeyframe = 0;         // Deltas pushed since the newest keyframe
+    std::vector<unsigned char> keyframeState;
+    std::vector<unsigned char> state;       // Scratch for the state being saved or restored
+};
+
+#endif //CHIP8_REWIND_H
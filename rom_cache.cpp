@@ -0,0 +1,130 @@
+#include "rom_cache.h"
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_ROM_FILE_KEY 1
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+uint64_t fnv1a(const unsigned char* data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+void setError(std::string* error, const std::string& message) {
+    if (error != nullptr) {
+        *error = message;
+    }
+}
+
+}
+
+bool RomCache::FileKey::operator<(const FileKey& other) const {
+    if (device != other.device) return device < other.device;
+    if (inode != other.inode) return inode < other.inode;
+    if (size != other.size) return size < other.size;
+    return modified < other.modified;
+}
+
+RomCache& RomCache::instance() {
+    static RomCache cache;
+    return cache;
+}
+
+std::shared_ptr<const RomImage> RomCache::load(const std::string& path, std::string* error) {
+#ifdef CHIP8_ROM_FILE_KEY
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        setError(error, "Could not open " + path);
+        return nullptr;
+    }
+    FileKey key = { (unsigned long long) info.st_dev, (unsigned long long) info.st_ino,
+                    (long long) info.st_size, (long long) info.st_mtime };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = byFile.find(key);
+        if (found != byFile.end()) {
+            return found->second;
+        }
+    }
+#endif
+
+    std::shared_ptr<RomImage> image = readImage(path, error);
+    if (image == nullptr) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const RomImage> shared = share(image);
+#ifdef CHIP8_ROM_FILE_KEY
+    byFile[key] = shared;
+#endif
+    return shared;
+}
+
+std::shared_ptr<const RomImage> RomCache::add(const unsigned char* data, size_t size, std::string* error) {
+    if (size == 0 || size > MAX_ROM_SIZE) {
+        setError(error, "ROM is empty or larger than " + std::to_string(MAX_ROM_SIZE) + " bytes");
+        return nullptr;
+    }
+
+    std::shared_ptr<RomImage> image(new RomImage());
+    image->contents.assign(data, data + size);
+    image->contentHash = fnv1a(image->data(), image->size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return share(image);
+}
+
+std::shared_ptr<const RomImage> RomCache::share(const std::shared_ptr<RomImage>& image) {
+    auto range = byHash.equal_range(image->hash());
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->size() == image->size() &&
+            std::memcmp(it->second->data(), image->data(), image->size()) == 0) {
+            return it->second;
+        }
+    }
+    byHash.insert(std::make_pair(image->hash(), image));
+    return image;
+}
+
+size_t RomCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return byHash.size();
+}
+
+void RomCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    byFile.clear();
+    byHash.clear();
+}
+
+std::shared_ptr<RomImage> RomCache::readImage(const std::string& path, std::string* error) {
+    std::shared_ptr<RomImage> image(new RomImage());
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        setError(error, "Could not open " + path);
+        return nullptr;
+    }
+    // Reading one byte more than fits tells a file that is too large
+    image->contents.resize(MAX_ROM_SIZE + 1);
+    size_t read = fread(image->contents.data(), 1, image->contents.size(), file);
+    fclose(file);
+    if (read == 0 || read > MAX_ROM_SIZE) {
+        setError(error, path + " is empty or larger than " + std::to_string(MAX_ROM_SIZE) + " bytes");
+        return nullptr;
+    }
+    image->contents.resize(read);
+    image->contents.shrink_to_fit();
+
+    image->contentHash = fnv1a(image->data(), image->size());
+    return image;
+}
@@ -0,0 +1,87 @@
+#ifndef CHIP8_ROM_CACHE_H
+#define CHIP8_ROM_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Program space above 0x200 in the 64K XO-CHIP memory. Chip8::loadProgram() checks the
+// smaller platforms.
+const size_t MAX_ROM_SIZE = 65536 - 0x200;
+
+// Immutable, validated ROM contents. Owns a copy of the file: ROMs are at most 64K, and a
+// file mapping would fault if the file were truncated and change under hash() if it were
+// rewritten in place.
+class RomImage {
+public:
+    RomImage(const RomImage&) = delete;
+    RomImage& operator=(const RomImage&) = delete;
+
+    // Returns the ROM bytes
+    const unsigned char* data() const { return contents.data(); }
+
+    // Returns the ROM size in bytes
+    size_t size() const { return contents.size(); }
+
+    // Returns the 64-bit FNV-1a hash of the contents
+    uint64_t hash() const { return contentHash; }
+
+private:
+    friend class RomCache;
+
+    RomImage() = default;
+
+    std::vector<unsigned char> contents;
+    uint64_t contentHash = 0;
+};
+
+// Process-wide cache of ROM images. Files are read and validated once; images with
+// identical contents are shared, whichever path they were loaded from. Thread-safe.
+class RomCache {
+public:
+    // Returns the process-wide cache
+    static RomCache& instance();
+
+    // Returns the image of the ROM at path, loading it on first use.
+    // Returns nullptr and sets error if the file can't be read or doesn't fit in memory.
+    std::shared_ptr<const RomImage> load(const std::string& path, std::string* error = nullptr);
+
+    // Returns the image of a ROM held in memory (generated, received over the network...).
+    // Returns nullptr and sets error if it doesn't fit in memory.
+    std::shared_ptr<const RomImage> add(const unsigned char* data, size_t size, std::string* error = nullptr);
+
+    // Returns the number of distinct images held
+    size_t size();
+
+    // Drops all cached images. Images still referenced elsewhere stay alive.
+    void clear();
+
+private:
+    // Identity of a file on disk, so unchanged files skip reading and hashing
+    struct FileKey {
+        unsigned long long device;
+        unsigned long long inode;
+        long long size;
+        long long modified;
+
+        bool operator<(const FileKey& other) const;
+    };
+
+    RomCache() = default;
+
+    // Reads the file into a new image. Returns nullptr on failure.
+    std::shared_ptr<RomImage> readImage(const std::string& path, std::string* error);
+
+    // Returns the cached image with the same contents as image, inserting image if there is none.
+    // Must be called with mutex held.
+    std::shared_ptr<const RomImage> share(const std::shared_ptr<RomImage>& image);
+
+    std::mutex mutex;
+    std::map<FileKey, std::shared_ptr<const RomImage>> byFile;
+    std::multimap<uint64_t, std::shared_ptr<const RomImage>> byHash;
+};
+
+#endif //CHIP8_ROM_CACHE_H
@@ -0,0 +1,82 @@
+#include "scheduler.h"
+#include "chip8_jit.h"
+#include "chip8_threaded.h"
+#include <thread>
+
+namespace {
+
+const Scheduler::Clock::duration FRAME_PERIOD =
+        std::chrono::duration_cast<Scheduler::Clock::duration>(std::chrono::nanoseconds(1000000000 / Scheduler::FRAME_RATE));
+
+// How far behind the deadline we may fall before giving up on catching up
+const unsigned int MAX_LAG_FRAMES = 4;
+
+}
+
+Scheduler::Scheduler(Chip8& chip8) : chip8(chip8), nextFrame(Clock::now()) {
+}
+
+void Scheduler::setInstructionsPerFrame(unsigned int instructions) {
+    instructionsPerFrame = instructions;
+}
+
+unsigned int Scheduler::getInstructionsPerFrame() const {
+    return instructionsPerFrame;
+}
+
+void Scheduler::setUncapped(bool uncapped) {
+    this->uncapped = uncapped;
+    nextFrame = Clock::now();
+}
+
+void Scheduler::setJit(Chip8Jit* jit) {
+    this->jit = jit;
+    overrun = 0;
+}
+
+void Scheduler::setThreaded(Chip8Threaded* threaded) {
+    this->threaded = threaded;
+}
+
+unsigned int Scheduler::runFrame() {
+    unsigned int executed = 0;
+    if (jit != nullptr) {
+        // A block may run past the budget. It only holds register and ALU instructions, which
+        // can't tell whether the timers ticked before them, so charging the overrun to the next
+        // frame keeps every frame ending in the same state as in the interpreter.
+        unsigned int budget = instructionsPerFrame > overrun ? instructionsPerFrame - overrun : 0;
+        overrun -= instructionsPerFrame - budget;
+        while (executed < budget && !chip8.isWaitingForKey() && chip8.getFault() == Chip8::FAULT_NONE) {
+            executed += jit->step();
+            executed = chip8.skipIdleLoop(executed, budget);
+        }
+        overrun += executed > budget ? executed - budget : 0;
+    } else if (threaded != nullptr) {
+        executed = threaded->run(instructionsPerFrame);
+    } else {
+        executed = chip8.run(instructionsPerFrame);
+    }
+
+    chip8.tickTimers();
+    ++frameCount;
+    return executed;
+}
+
+void Scheduler::waitForNextFrame() {
+    if (uncapped) {
+        return;
+    }
+
+    nextFrame += FRAME_PERIOD;
+    Clock::time_point now = Clock::now();
+    if (now > nextFrame + FRAME_PERIOD * MAX_LAG_FRAMES) {
+        // Stalled (debugger, suspended host...), resume from now instead of bursting
+        nextFrame = now;
+        return;
+    }
+    std::this_thread::sleep_until(nextFrame);
+}
+
+unsigned long long Scheduler::getFrameCount() const {
+    return frameCount;
+}
@@ -0,0 +1,64 @@
+#ifndef CHIP8_SCHEDULER_H
+#define CHIP8_SCHEDULER_H
+
+#include <chrono>
+#include "chip8.h"
+
+class Chip8Jit;
+class Chip8Threaded;
+
+// Drives a Chip8 in 60 Hz frames: each frame executes a fixed instruction budget and
+// ticks the timers once. Frames are paced against a monotonic clock, or run back to
+// back in uncapped mode. A frame ends early when an Fx0A halts the CPU or a fault
+// stops it; the timers still tick. Idle loops waiting for the timers or keys are
+// skipped to the end of the frame's budget (see Chip8::skipIdleLoop()), which changes nothing but host CPU time.
+class Scheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Timer and frame rate of the Chip8
+    static const unsigned int FRAME_RATE = 60;
+
+    explicit Scheduler(Chip8& chip8);
+
+    // Sets the number of instructions executed per frame
+    void setInstructionsPerFrame(unsigned int instructions);
+
+    // Returns the number of instructions executed per frame
+    unsigned int getInstructionsPerFrame() const;
+
+    // Runs frames as fast as possible when set, instead of at 60 Hz
+    void setUncapped(bool uncapped);
+
+    // Executes instructions through jit instead of the interpreter. Nullptr selects the interpreter.
+    void setJit(Chip8Jit* jit);
+
+    // Executes instructions through the table-dispatched engine instead of the interpreter,
+    // unless a JIT is set. Nullptr selects the interpreter.
+    void setThreaded(Chip8Threaded* threaded);
+
+    // Emulates one frame. Returns the number of executed instructions, 0 while waiting for a key.
+    unsigned int runFrame();
+
+    // Sleeps until the next frame is due. Returns immediately when uncapped.
+    void waitForNextFrame();
+
+    // Returns the number of frames run so far
+    unsigned long long getFrameCount() const;
+
+    // Returns the instructions the JIT ran past the frame budgets so far, owed by the next frames.
+    // While it is not 0 the machine is ahead of where the interpreter would be.
+    unsigned int getOverrun() const { return overrun; }
+
+private:
+    Chip8& chip8;
+    Chip8Jit* jit = nullptr;
+    Chip8Threaded* threaded = nullptr;
+    unsigned int instructionsPerFrame = 10;
+    bool uncapped = false;
+    unsigned long long frameCount = 0;
+    unsigned int overrun = 0;       // Instructions the JIT ran past earlier frame budgets
+    Clock::time_point nextFrame;    // Deadline of the next frame
+};
+
+#endif //CHIP8_SCHEDULER_H
@@ -0,0 +1,46 @@
+#include "sdl_audio.h"
+#include "audio.h"
+#include <cstring>
+#include <iostream>
+#include <SDL.h>
+
+namespace {
+
+// Samples per device callback, 5.3 ms at 48 kHz
+const Uint16 BUFFER_SAMPLES = 256;
+
+}
+
+SdlAudio::~SdlAudio() {
+    if (device != 0) {
+        SDL_CloseAudioDevice(device);
+    }
+}
+
+bool SdlAudio::initialize(ToneSynth& synth) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        std::cout << "SDL audio could not initialize! SDL_Error: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    SDL_AudioSpec want;
+    std::memset(&want, 0, sizeof(want));
+    want.freq = synth.getSampleRate();
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = BUFFER_SAMPLES;
+    want.callback = fill;
+    want.userdata = &synth;
+    // No allowed changes, SDL converts to whatever the hardware wants
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, nullptr, 0);
+    if (device == 0) {
+        std::cout << "Audio device could not be opened! SDL_Error: " << SDL_GetError() << "\n";
+        return false;
+    }
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void SdlAudio::fill(void* synth, uint8_t* stream, int len) {
+    static_cast<ToneSynth*>(synth)->render(reinterpret_cast<int16_t*>(stream), len / sizeof(int16_t));
+}
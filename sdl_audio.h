@@ -0,0 +1,29 @@
+#ifndef CHIP8_SDL_AUDIO_H
+#define CHIP8_SDL_AUDIO_H
+
+#include <cstdint>
+
+class ToneSynth;
+
+// Plays a ToneSynth on the default SDL audio device. The device pulls samples from its own
+// thread in bursts shorter than a frame, and the synth never waits on the emulation.
+class SdlAudio {
+public:
+    SdlAudio() = default;
+    ~SdlAudio();
+
+    SdlAudio(const SdlAudio&) = delete;
+    SdlAudio& operator=(const SdlAudio&) = delete;
+
+    // Initializes SDL audio, opens the device at synth's sample rate and starts it.
+    // Returns false if there is no audio device.
+    bool initialize(ToneSynth& synth);
+
+private:
+    // SDL audio callback, renders len bytes of samples
+    static void fill(void* synth, uint8_t* stream, int len);
+
+    uint32_t device = 0;
+};
+
+#endif //CHIP8_SDL_AUDIO_H
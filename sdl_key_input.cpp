@@ -0,0 +1,48 @@
+#include "sdl_key_input.h"
+#include <sstream>
+#include <SDL.h>
+
+namespace {
+
+const char* const DEFAULT_LAYOUT = "1 2 3 4 Q W E R A S D F Z X C V";
+
+}
+
+SdlKeyInput::SdlKeyInput() {
+    setLayout(DEFAULT_LAYOUT);
+}
+
+bool SdlKeyInput::setLayout(const std::string& layout) {
+    std::vector<signed char> mapping(SDL_NUM_SCANCODES, -1);
+    std::istringstream names(layout);
+    std::string name;
+    int key = 0;
+    while (names >> name) {
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name.c_str());
+        if (key >= 16 || scancode == SDL_SCANCODE_UNKNOWN) {
+            return false;
+        }
+        mapping[scancode] = key++;
+    }
+    if (key != 16) {
+        return false;
+    }
+    keyOfScancode.swap(mapping);
+    return true;
+}
+
+bool SdlKeyInput::handleEvent(const SDL_Event& event) {
+    if ((event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) || event.key.repeat != 0) {
+        return false;
+    }
+    SDL_Scancode scancode = event.key.keysym.scancode;
+    if (scancode < 0 || scancode >= SDL_NUM_SCANCODES || keyOfScancode[scancode] < 0) {
+        return false;
+    }
+    if (event.type == SDL_KEYDOWN) {
+        press(keyOfScancode[scancode]);
+    } else {
+        release(keyOfScancode[scancode]);
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef CHIP8_SDL_KEY_INPUT_H
+#define CHIP8_SDL_KEY_INPUT_H
+
+#include <string>
+#include <vector>
+#include "key_state.h"
+
+union SDL_Event;
+
+// Keypad fed by SDL keyboard events through a configurable scancode layout.
+// Default layout: 1 2 3 4 / Q W E R / A S D F / Z X C V -> keys 0x0..0xF
+class SdlKeyInput : public KeyState {
+public:
+    SdlKeyInput();
+
+    // Binds keys 0x0..0xF to the 16 SDL key names in layout, separated by spaces,
+    // e.g. "X 1 2 3 Q W E A S D Z C 4 R F V". Returns false, keeping the old layout,
+    // if a name is unknown or there aren't 16 of them.
+    bool setLayout(const std::string& layout);
+
+    // Applies a key down or up event. Returns true if it was for a mapped key.
+    bool handleEvent(const SDL_Event& event);
+
+private:
+    std::vector<signed char> keyOfScancode;     // Keypad key per SDL scancode, -1 if unmapped
+};
+
+#endif //CHIP8_SDL_KEY_INPUT_H
@@ -0,0 +1,112 @@
+#include "sdl_renderer.h"
+#include "chip8.h"
+#include <cstring>
+#include <iostream>
+#include <SDL.h>
+
+namespace {
+
+// Pixel colors by plane bits: off, plane 0, plane 1, both
+const uint32_t PALETTE[4] = { 0xFF000000, 0xFFFFFFFF, 0xFFFF8000, 0xFF808080 };
+
+}
+
+SdlRenderer::~SdlRenderer() {
+    if (texture != nullptr) {
+        SDL_DestroyTexture(texture);
+    }
+    if (renderer != nullptr) {
+        SDL_DestroyRenderer(renderer);
+    }
+    if (window != nullptr) {
+        SDL_DestroyWindow(window);
+    }
+}
+
+bool SdlRenderer::initialize(const char* title, int width, int height) {
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        std::cout << "SDL could not initialize! SDL_Error: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_SHOWN);
+    if (window == nullptr) {
+        std::cout << "Window could not be created! SDL_Error: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == nullptr) {
+        std::cout << "Renderer could not be created! SDL Error: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                Chip8::MAX_WIDTH, Chip8::MAX_HEIGHT);
+    if (texture == nullptr) {
+        std::cout << "Texture could not be created! SDL Error: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    // Start from a black screen
+    uploadRows(nullptr, nullptr, 0, height - 1);
+    return true;
+}
+
+void SdlRenderer::update(const uint64_t* plane0, const uint64_t* plane1, unsigned int width, unsigned int height,
+                         uint64_t dirtyRows) {
+    // A resolution switch changes how every row maps to the texture
+    if (width != this->width) {
+        this->width = width;
+        this->height = height;
+        dirtyRows = ~0ull;
+    }
+
+    // Upload each run of consecutive dirty rows with one lock
+    unsigned int row = 0;
+    while (row < height) {
+        if ((dirtyRows & (1ull << row)) == 0) {
+            ++row;
+            continue;
+        }
+        unsigned int first = row;
+        while (row < height && (dirtyRows & (1ull << row)) != 0) {
+            ++row;
+        }
+        uploadRows(plane0, plane1, first, row - 1);
+    }
+}
+
+void SdlRenderer::uploadRows(const uint64_t* plane0, const uint64_t* plane1, unsigned int first, unsigned int last) {
+    unsigned int scale = Chip8::MAX_WIDTH / width;
+    SDL_Rect rect = { 0, (int) (first * scale), (int) Chip8::MAX_WIDTH, (int) ((last - first + 1) * scale) };
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0) {
+        return;
+    }
+
+    for (unsigned int y = first; y <= last; ++y) {
+        unsigned char* base = static_cast<unsigned char*>(pixels) + (y - first) * scale * pitch;
+        uint32_t* line = reinterpret_cast<uint32_t*>(base);
+        for (unsigned int x = 0; x < width; ++x) {
+            unsigned int word = y * Chip8::ROW_WORDS + x / 64;
+            unsigned int bit = 63 - x % 64;
+            unsigned int color = (plane0 != nullptr ? (plane0[word] >> bit) & 0x1 : 0) |
+                                 (plane1 != nullptr ? ((plane1[word] >> bit) & 0x1) << 1 : 0);
+            for (unsigned int s = 0; s < scale; ++s) {
+                line[x * scale + s] = PALETTE[color];
+            }
+        }
+        for (unsigned int s = 1; s < scale; ++s) {
+            std::memcpy(base + s * pitch, base, Chip8::MAX_WIDTH * sizeof(uint32_t));
+        }
+    }
+
+    SDL_UnlockTexture(texture);
+}
+
+void SdlRenderer::present() {
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,43 @@
+#ifndef CHIP8_SDL_RENDERER_H
+#define CHIP8_SDL_RENDERER_H
+
+#include <cstdint>
+
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+
+// Draws the Chip8 screen through one 128x64 streaming texture, scaled to the window
+// with a single copy. Lo-res screens fill it with 2x2 texels per pixel, and XO-CHIP's
+// two bitplanes map to four colors. Only the rows reported dirty are converted and uploaded.
+class SdlRenderer {
+public:
+    SdlRenderer() = default;
+    ~SdlRenderer();
+
+    SdlRenderer(const SdlRenderer&) = delete;
+    SdlRenderer& operator=(const SdlRenderer&) = delete;
+
+    // Initializes SDL video, creates the window, renderer and screen texture. Returns false on failure.
+    bool initialize(const char* title, int width, int height);
+
+    // Uploads the rows set in dirtyRows from the packed bitplanes of a width x height screen
+    // (see Chip8::getFramebuffer()). plane1 may be nullptr for a single plane.
+    void update(const uint64_t* plane0, const uint64_t* plane1, unsigned int width, unsigned int height,
+                uint64_t dirtyRows);
+
+    // Scales the screen texture to the window and presents it, synchronized to the display refresh
+    void present();
+
+private:
+    // Converts and uploads screen rows [first, last]
+    void uploadRows(const uint64_t* plane0, const uint64_t* plane1, unsigned int first, unsigned int last);
+
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+    unsigned int width = 64;            // Size of the screen the texture shows
+    unsigned int height = 32;
+};
+
+#endif //CHIP8_SDL_RENDERER_H
@@ -0,0 +1,204 @@
+#include "session_host.h"
+#include "aligned_new.h"
+#include "delta.h"
+#include "frame_buffer.h"
+#include "key_state.h"
+#include "rom_cache.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+const SessionHost::Clock::duration FRAME_PERIOD =
+        std::chrono::duration_cast<SessionHost::Clock::duration>(std::chrono::nanoseconds(1000000000 / Scheduler::FRAME_RATE));
+
+// How far behind the clock may fall before it gives up on catching up, as Scheduler does
+const unsigned int MAX_LAG_FRAMES = 4;
+
+// Writes the screen of frame as SessionHost::SCREEN_BYTES little-endian bytes
+void serializeScreen(const Frame& frame, unsigned char* out) {
+    const uint64_t* words = &frame.rows[0][0][0];
+    for (size_t i = 0; i < SessionHost::SCREEN_BYTES / 8; ++i) {
+        for (int byte = 0; byte < 8; ++byte) {
+            *out++ = (words[i] >> (8 * byte)) & 0xFF;
+        }
+    }
+}
+
+void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+}
+
+struct SessionHost::Session : AlignedNew<Session> {
+    Session() : scheduler(chip8) {}
+
+    Chip8 chip8;
+    Scheduler scheduler;                // Only counts frames, the host clock paces them
+    KeyState keys;
+    FrameBuffer frames;                 // Screens from the worker that ran the frame to pullFrame()
+    std::atomic<bool> running{false};   // Set while a frame is queued or running
+    std::atomic<uint64_t> frameCount{0};
+    std::atomic<uint64_t> lateFrames{0};
+    std::atomic<uint64_t> latencyTotal{0};
+    std::atomic<uint64_t> latencyMax{0};
+    std::mutex pullMutex;               // Guards the consumer side of frames and pulled
+    Frame pulled = Frame();             // Screen of the last pull, the reference of the next delta
+    bool hasPulled = false;
+};
+
+SessionHost::SessionHost(unsigned int threads) : pool(threads) {
+    clock = std::thread(&SessionHost::runClock, this);
+}
+
+SessionHost::~SessionHost() {
+    {
+        std::lock_guard<std::mutex> lock(clockMutex);
+        stopping = true;
+    }
+    clockStop.notify_all();
+    clock.join();
+}
+
+uint32_t SessionHost::create(const std::shared_ptr<const RomImage>& rom, Chip8::Platform platform, uint32_t seed,
+                             unsigned int instructionsPerFrame, std::string* error) {
+    std::shared_ptr<Session> session(new Session());
+    session->chip8.initialize(seed, platform);
+    if (!session->chip8.loadProgram(*rom)) {
+        *error = std::string("program doesn't fit in ") + Chip8::platformName(platform) + " memory";
+        return 0;
+    }
+    session->chip8.setKeyInput(&session->keys);
+    session->scheduler.setInstructionsPerFrame(instructionsPerFrame);
+    session->scheduler.setUncapped(true);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t id = nextId++;
+    sessions[id] = session;
+    return id;
+}
+
+bool SessionHost::destroy(uint32_t id) {
+    // A frame still running keeps its session alive until it ends
+    std::lock_guard<std::mutex> lock(mutex);
+    return sessions.erase(id) != 0;
+}
+
+bool SessionHost::setKeys(uint32_t id, uint16_t keys) {
+    std::shared_ptr<Session> session = find(id);
+    if (session == nullptr) {
+        return false;
+    }
+    session->keys.set(keys);
+    return true;
+}
+
+bool SessionHost::pullFrame(uint32_t id, FrameUpdate& update) {
+    std::shared_ptr<Session> session = find(id);
+    if (session == nullptr) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(session->pullMutex);
+    update.delta.clear();
+    const Frame* frame = session->frames.acquire();
+    if (frame != nullptr) {
+        unsigned char previous[SCREEN_BYTES];
+        unsigned char current[SCREEN_BYTES];
+        serializeScreen(session->pulled, previous);
+        serializeScreen(*frame, current);
+        encodeDelta(session->hasPulled ? previous : nullptr, current, SCREEN_BYTES, update.delta);
+        session->pulled = *frame;
+        session->hasPulled = true;
+    }
+    update.number = session->hasPulled ? session->pulled.number : 0;
+    update.width = session->hasPulled ? session->pulled.width : 0;
+    update.height = session->hasPulled ? session->pulled.height : 0;
+    update.planeCount = session->hasPulled ? session->pulled.planeCount : 0;
+    return true;
+}
+
+bool SessionHost::getStats(uint32_t id, SessionStats& stats) {
+    std::shared_ptr<Session> session = find(id);
+    if (session == nullptr) {
+        return false;
+    }
+    stats.frames = session->frameCount.load(std::memory_order_relaxed);
+    stats.lateFrames = session->lateFrames.load(std::memory_order_relaxed);
+    stats.latencyTotalNanoseconds = session->latencyTotal.load(std::memory_order_relaxed);
+    stats.latencyMaxNanoseconds = session->latencyMax.load(std::memory_order_relaxed);
+    return true;
+}
+
+size_t SessionHost::getSessionCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sessions.size();
+}
+
+void SessionHost::runClock() {
+    Clock::time_point due = Clock::now();
+    std::unique_lock<std::mutex> lock(clockMutex);
+    while (!stopping) {
+        lock.unlock();
+        tick(due);
+        lock.lock();
+
+        due += FRAME_PERIOD;
+        Clock::time_point now = Clock::now();
+        if (now > due + FRAME_PERIOD * MAX_LAG_FRAMES) {
+            // Stalled, resume from now instead of bursting
+            due = now;
+        }
+        clockStop.wait_until(lock, due, [this] { return stopping; });
+    }
+}
+
+void SessionHost::tick(Clock::time_point due) {
+    std::vector<std::shared_ptr<Session>> order;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.reserve(sessions.size());
+        for (const auto& entry : sessions) {
+            order.push_back(entry.second);
+        }
+        if (!order.empty()) {
+            rotation %= order.size();
+            std::rotate(order.begin(), order.begin() + rotation, order.end());
+            ++rotation;
+        }
+    }
+
+    for (const std::shared_ptr<Session>& session : order) {
+        if (session->running.exchange(true, std::memory_order_acquire)) {
+            session->lateFrames.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        pool.submit([session, due] { runFrame(*session, due); });
+    }
+}
+
+void SessionHost::runFrame(Session& session, Clock::time_point due) {
+    session.chip8.setKeys();
+    session.scheduler.runFrame();
+    if (session.chip8.getDrawFlag()) {
+        session.frames.back().capture(session.chip8, session.scheduler.getFrameCount());
+        session.frames.publish();
+        session.chip8.clearDrawFlag();
+    }
+
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count();
+    session.latencyTotal.fetch_add(latency, std::memory_order_relaxed);
+    updateMax(session.latencyMax, latency);
+    session.frameCount.fetch_add(1, std::memory_order_relaxed);
+    session.running.store(false, std::memory_order_release);
+}
+
+std::shared_ptr<SessionHost::Session> SessionHost::find(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sessions.find(id);
+    return it != sessions.end() ? it->second : nullptr;
+}
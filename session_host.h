@@ -0,0 +1,106 @@
+#ifndef CHIP8_SESSION_HOST_H
+#define CHIP8_SESSION_HOST_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "work_pool.h"
+
+class RomImage;
+
+// Counters of one session
+struct SessionStats {
+    uint64_t frames;                    // Frames emulated
+    uint64_t lateFrames;                // Ticks skipped because the previous frame was still running
+    uint64_t latencyTotalNanoseconds;   // From a frame's tick to the end of its emulation, in total and at worst
+    uint64_t latencyMaxNanoseconds;
+};
+
+// The newest screen of a session, delta coded against the screen pulled before it
+struct FrameUpdate {
+    uint64_t number;                    // Emulated frame the screen was captured after, 0 before the first
+    unsigned int width;                 // As Chip8::getWidth(), getHeight() and getPlaneCount()
+    unsigned int height;
+    unsigned int planeCount;
+    std::vector<unsigned char> delta;   // encodeDelta() of the SCREEN_BYTES bytes, empty if nothing changed
+};
+
+// Hosts many independent Chip8 sessions in one process. A clock thread ticks at 60 Hz and
+// hands every session one frame per tick to a work-stealing pool, starting each tick at the
+// next session so none is always served last. A session whose previous frame is still
+// running sits the tick out, which is counted as a late frame. Keys can be pushed and screens
+// pulled from any thread.
+class SessionHost {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Size of the screen a FrameUpdate delta decodes to: every plane's MAX_HEIGHT rows of
+    // ROW_WORDS words (as Chip8::getFramebuffer()), each word as a little-endian u64
+    static const size_t SCREEN_BYTES = Chip8::PLANE_COUNT * Chip8::MAX_HEIGHT * Chip8::ROW_WORDS * 8;
+
+    // Starts threads pool workers and the frame clock
+    explicit SessionHost(unsigned int threads);
+
+    // Stops the clock, lets running frames finish and drops all sessions
+    ~SessionHost();
+
+    SessionHost(const SessionHost&) = delete;
+    SessionHost& operator=(const SessionHost&) = delete;
+
+    // Starts a session running rom. Returns its id, or 0 and sets error if rom doesn't fit the platform.
+    uint32_t create(const std::shared_ptr<const RomImage>& rom, Chip8::Platform platform, uint32_t seed,
+                    unsigned int instructionsPerFrame, std::string* error);
+
+    // Ends a session. Returns false if there is no session id.
+    bool destroy(uint32_t id);
+
+    // Sets the keypad of a session from its next frame on, bit n for key n. Returns false if there is no session id.
+    bool setKeys(uint32_t id, uint16_t keys);
+
+    // Fills update with the newest screen of a session, delta coded against the previous pull.
+    // The first pull is a keyframe. Returns false if there is no session id.
+    bool pullFrame(uint32_t id, FrameUpdate& update);
+
+    // Returns false if there is no session id
+    bool getStats(uint32_t id, SessionStats& stats);
+
+    // Returns the number of sessions
+    size_t getSessionCount();
+
+    // Returns the pool the frames run on, for its counters
+    const WorkStealingPool& getPool() const { return pool; }
+
+private:
+    struct Session;
+
+    // Clock thread body
+    void runClock();
+
+    // Queues a frame due at due for every session
+    void tick(Clock::time_point due);
+
+    // Emulates one frame of session, on a pool worker
+    static void runFrame(Session& session, Clock::time_point due);
+
+    // Returns session id, nullptr if there is none
+    std::shared_ptr<Session> find(uint32_t id);
+
+    std::mutex mutex;                   // Guards sessions, nextId and rotation
+    std::map<uint32_t, std::shared_ptr<Session>> sessions;
+    uint32_t nextId = 1;
+    size_t rotation = 0;                // Position of the session served first on the next tick
+    WorkStealingPool pool;
+    std::mutex clockMutex;              // Guards stopping
+    std::condition_variable clockStop;
+    bool stopping = false;
+    std::thread clock;
+};
+
+#endif //CHIP8_SESSION_HOST_H
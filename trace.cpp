@@ -0,0 +1,149 @@
+#include "trace.h"
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// Records moved from the ring to the file per batch
+const size_t WRITE_BATCH = 4096;
+
+void putU16(unsigned char* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+uint16_t getU16(const unsigned char* in) {
+    return in[0] | (in[1] << 8);
+}
+
+}
+
+TraceRing::TraceRing(size_t capacity) : head(0), tail(0), dropped(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer.resize(size);
+    mask = size - 1;
+}
+
+size_t TraceRing::pop(TraceRecord* out, size_t max) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t available = head.load(std::memory_order_acquire) - t;
+    size_t count = available < max ? available : max;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = buffer[(t + i) & mask];
+    }
+    tail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+uint64_t TraceRing::takeDropped() {
+    return dropped.exchange(0, std::memory_order_relaxed);
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const char* path, size_t capacity) {
+    close();
+
+    file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    unsigned char header[8];
+    std::memcpy(header, TRACE_MAGIC, 4);
+    putU16(header + 4, TRACE_VERSION);
+    putU16(header + 6, TRACE_RECORD_SIZE);
+    fwrite(header, 1, sizeof(header), file);
+
+    ring.reset(new TraceRing(capacity));
+    stopping = false;
+    thread = std::thread(&TraceWriter::run, this);
+    return true;
+}
+
+void TraceWriter::close() {
+    if (thread.joinable()) {
+        stopping = true;
+        thread.join();
+    }
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+    ring.reset();
+}
+
+TraceRing* TraceWriter::getRing() {
+    return ring.get();
+}
+
+void TraceWriter::run() {
+    std::vector<TraceRecord> batch(WRITE_BATCH);
+    for (;;) {
+        // Read the flag before draining so nothing pushed before close() is lost
+        bool last = stopping.load();
+
+        uint64_t dropped = ring->takeDropped();
+        if (dropped > 0) {
+            TraceRecord gap = { TRACE_GAP, (uint16_t) (dropped & 0xFFFF), (uint16_t) ((dropped >> 16) & 0xFFFF),
+                                TRACE_NO_REGISTER, 0 };
+            write(&gap, 1);
+        }
+
+        size_t count = ring->pop(batch.data(), batch.size());
+        write(batch.data(), count);
+
+        if (count == 0) {
+            if (last) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    fflush(file);
+}
+
+void TraceWriter::write(const TraceRecord* records, size_t count) {
+    unsigned char bytes[TRACE_RECORD_SIZE * 256];
+    while (count > 0) {
+        size_t chunk = count < 256 ? count : 256;
+        for (size_t i = 0; i < chunk; ++i) {
+            unsigned char* out = bytes + i * TRACE_RECORD_SIZE;
+            putU16(out, records[i].pc);
+            putU16(out + 2, records[i].opcode);
+            putU16(out + 4, records[i].I);
+            out[6] = records[i].reg;
+            out[7] = records[i].value;
+        }
+        fwrite(bytes, TRACE_RECORD_SIZE, chunk, file);
+        records += chunk;
+        count -= chunk;
+    }
+}
+
+bool readTraceHeader(FILE* file) {
+    unsigned char header[8];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        return false;
+    }
+    return std::memcmp(header, TRACE_MAGIC, 4) == 0 && getU16(header + 4) == TRACE_VERSION &&
+           getU16(header + 6) == TRACE_RECORD_SIZE;
+}
+
+bool readTraceRecord(FILE* file, TraceRecord& record) {
+    unsigned char in[TRACE_RECORD_SIZE];
+    if (fread(in, 1, sizeof(in), file) != sizeof(in)) {
+        return false;
+    }
+    record.pc = getU16(in);
+    record.opcode = getU16(in + 2);
+    record.I = getU16(in + 4);
+    record.reg = in[6];
+    record.value = in[7];
+    return true;
+}
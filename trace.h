@@ -0,0 +1,103 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "aligned_new.h"
+
+// One executed instruction
+struct TraceRecord {
+    uint16_t pc;                    // Address the instruction was fetched from
+    uint16_t opcode;                // Executed opcode
+    uint16_t I;                     // Index register after execution
+    uint8_t reg;                    // V register the instruction changed, TRACE_NO_REGISTER if none
+    uint8_t value;                  // New value of that register
+};
+
+// TraceRecord::reg when no V register changed
+const uint8_t TRACE_NO_REGISTER = 0xFF;
+
+// TraceRecord::pc of a gap record: opcode (low) and I (high) hold the number of dropped records
+const uint16_t TRACE_GAP = 0xFFFF;
+
+// Trace file layout: "C8TR", u16 version, u16 record size, then little-endian records
+// of u16 pc, u16 opcode, u16 I, u8 reg, u8 value.
+const char TRACE_MAGIC[4] = { 'C', '8', 'T', 'R' };
+const uint16_t TRACE_VERSION = 1;
+const uint16_t TRACE_RECORD_SIZE = 8;
+
+// Fixed-size lock-free single producer, single consumer ring of trace records.
+// The producer never waits: records pushed into a full ring are counted and dropped.
+class TraceRing : public AlignedNew<TraceRing> {
+public:
+    // Capacity is rounded up to a power of two
+    explicit TraceRing(size_t capacity);
+
+    // Producer side. Returns false if the ring was full and the record was dropped.
+    bool push(const TraceRecord& record) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == buffer.size()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        buffer[h & mask] = record;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Moves up to max records into out, returns how many.
+    size_t pop(TraceRecord* out, size_t max);
+
+    // Consumer side. Returns and resets the number of dropped records.
+    uint64_t takeDropped();
+
+private:
+    std::vector<TraceRecord> buffer;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;       // Next slot the producer writes
+    alignas(64) std::atomic<size_t> tail;       // Next slot the consumer reads
+    alignas(64) std::atomic<uint64_t> dropped;  // Records lost to a full ring
+};
+
+// Drains a TraceRing to a trace file on a background thread
+class TraceWriter {
+public:
+    TraceWriter() = default;
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Creates the file and starts the writer thread. Returns false if the file can't be created.
+    bool open(const char* path, size_t capacity = 1 << 16);
+
+    // Drains the remaining records, stops the thread and closes the file
+    void close();
+
+    // Ring to hand to Chip8::setTrace(), nullptr unless open
+    TraceRing* getRing();
+
+private:
+    // Writer thread body
+    void run();
+
+    // Writes records to the file
+    void write(const TraceRecord* records, size_t count);
+
+    std::unique_ptr<TraceRing> ring;
+    FILE* file = nullptr;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+};
+
+// Reads the next record from a trace file positioned after the header. Returns false at the end.
+bool readTraceRecord(FILE* file, TraceRecord& record);
+
+// Reads and checks a trace file header. Returns false if it is not a supported trace.
+bool readTraceHeader(FILE* file);
+
+#endif //CHIP8_TRACE_H
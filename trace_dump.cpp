@@ -0,0 +1,36 @@
+#include "trace.h"
+#include <cstdio>
+
+// Decodes a binary trace written by TraceWriter into one line per instruction.
+// Usage: chip8-tracedump <trace>
+int main(int argc, char* args[]) {
+    if (argc < 2) {
+        printf("Usage: %s <trace>\n", args[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(args[1], "rb");
+    if (file == nullptr) {
+        printf("Could not open %s\n", args[1]);
+        return 1;
+    }
+    if (!readTraceHeader(file)) {
+        printf("%s is not a Chip8 trace\n", args[1]);
+        fclose(file);
+        return 1;
+    }
+
+    TraceRecord record;
+    while (readTraceRecord(file, record)) {
+        if (record.pc == TRACE_GAP) {
+            printf("... %u records dropped\n", record.opcode | ((unsigned int) record.I << 16));
+        } else if (record.reg == TRACE_NO_REGISTER) {
+            printf("%03X  %04X  I=%03X\n", record.pc, record.opcode, record.I);
+        } else {
+            printf("%03X  %04X  I=%03X  V%X=%02X\n", record.pc, record.opcode, record.I, record.reg, record.value);
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "work_pool.h"
+
+namespace {
+
+// Pool and queue of the worker running on this thread, so tasks can queue follow-ups locally
+thread_local const WorkStealingPool* currentPool = nullptr;
+thread_local unsigned int currentQueue = 0;
+
+}
+
+WorkStealingPool::WorkStealingPool(unsigned int threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        queues.emplace_back(new Queue());
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        this->threads.emplace_back(&WorkStealingPool::work, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    unsigned int index = currentPool == this ? currentQueue
+                                             : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    // Counted before it is queued, so a worker taking it straight away never takes the count below zero
+    queued.fetch_add(1, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    // Taking the lock orders this after a worker that saw nothing queued has started waiting
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+unsigned int WorkStealingPool::getThreadCount() const {
+    return threads.size();
+}
+
+uint64_t WorkStealingPool::getCompletedCount() const {
+    return completed.load(std::memory_order_relaxed);
+}
+
+uint64_t WorkStealingPool::getStolenCount() const {
+    return stolen.load(std::memory_order_relaxed);
+}
+
+void WorkStealingPool::work(unsigned int index) {
+    currentPool = this;
+    currentQueue = index;
+    Task task;
+    for (;;) {
+        if (take(index, task)) {
+            task();
+            task = nullptr;
+            completed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping && queued.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::take(unsigned int index, Task& task) {
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Steal from the back, away from the owner working on the front
+    for (unsigned int i = 1; i < queues.size(); ++i) {
+        Queue& other = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.back());
+            other.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
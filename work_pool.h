@@ -0,0 +1,64 @@
+#ifndef CHIP8_WORK_POOL_H
+#define CHIP8_WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task queue. Tasks submitted from outside
+// are dealt round-robin over the queues, tasks submitted by a task go to its worker's queue.
+// A worker runs its own queue oldest first, and when it runs dry steals the newest task of
+// another queue, so a worker held up by a slow task doesn't hold up the ones behind it.
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    // Starts threads workers, at least one
+    explicit WorkStealingPool(unsigned int threads);
+
+    // Runs the tasks still queued, then stops the workers
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queues task to run on some worker. Thread-safe.
+    void submit(Task task);
+
+    // Returns the number of worker threads
+    unsigned int getThreadCount() const;
+
+    // Returns the number of tasks run, and of those run by another worker than the one they were queued on
+    uint64_t getCompletedCount() const;
+    uint64_t getStolenCount() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Worker thread body
+    void work(unsigned int index);
+
+    // Takes the oldest task of queue index, or steals the newest of another. Returns false if all are empty.
+    bool take(unsigned int index, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned int> nextQueue{0};     // Round-robin position for outside submissions
+    std::atomic<uint64_t> queued{0};            // Tasks submitted and not taken yet
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> stolen{0};
+    std::mutex sleepMutex;                      // Guards stopping and the sleeping workers
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#endif //CHIP8_WORK_POOL_H
@@ -0,0 +1,33 @@
+#ifndef CHIP8_XORSHIFT_H
+#define CHIP8_XORSHIFT_H
+
+#include <cstdint>
+
+// xorshift32, the random source of CXNN. Every machine owns its generator state, so a run
+// is reproducible from its seed and instances on different threads share nothing.
+
+// Returns the generator state for seed. Nearby seeds give unrelated sequences and the
+// state is never zero, which xorshift could not leave.
+inline uint32_t xorshiftSeed(uint32_t seed) {
+    seed ^= seed >> 16;
+    seed *= 0x7FEB352D;
+    seed ^= seed >> 15;
+    seed *= 0x846CA68B;
+    seed ^= seed >> 16;
+    return seed != 0 ? seed : 0x9E3779B9;
+}
+
+// Advances state and returns it
+inline uint32_t xorshift32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Random byte for CXNN, taken from the high bits
+inline uint8_t xorshiftByte(uint32_t& state) {
+    return xorshift32(state) >> 24;
+}
+
+#endif //CHIP8_XORSHIFT_H